@@ -46,94 +46,86 @@ IN THE SOFTWARE.
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
 
-static char strnident_buffer[256];
+#include "generaltools.h"
+#include "binformat.h"
 
-/*---------------------------------------------------------------------------------
-Print the closest valid C identifier to a given word.
----------------------------------------------------------------------------------*/
-char * strnident(const char *src, int apple_llvm ) {
-//---------------------------------------------------------------------------------
-	char got_first = 0;
-
-	memset(strnident_buffer,0,sizeof(strnident_buffer));
-
-	char *p = &strnident_buffer[0];
-
-	while(*src != 0) {
-
-		int s = *src++;
-
-		/* prepend _ for apple-llvm mode or initial digit  */
-		if((isdigit(s) || apple_llvm) && !got_first)
-		*p++ = '_';  /* stick a '_' before an initial digit */
-
-		/* convert only out-of-range characters */
-		if(!isalpha(s) && !isdigit(s) && (s != '_')) {
-			if(s == '-' || s == '.' || s == '/') s = '_';
-			else
-				s = 0;
-		}
-
-		if(s) {
-			*p++ = s;
-			got_first = 1;
-		}
-	}
-	return &strnident_buffer[0];
-}
+typedef struct {
+	char	**files;
+	int	count;
+	char	*header_name;
+	char	*output_dir;		/* -o: a .s per file, or per shard, in this directory */
+	char	*objects_name;		/* -M: make fragment listing the objects */
+	unsigned long	shard_size;	/* -s: bytes, larger files are split, 0 = never */
+	int	alignment;
+	int	apple_llvm;
+} bin2s_job;
 
 //---------------------------------------------------------------------------------
-void showhelp(char *name) {
+void showhelp(const gt_sink *log, char *name) {
 //---------------------------------------------------------------------------------
-	fprintf(stderr, "%s\n", PACKAGE_STRING );
-	fprintf(stderr, "%s - convert binary files to assembly language\n", name);
-
-	fprintf(stderr, "usage: %s [option ...] [binary files ...]\n", name);
-
-	fprintf(stderr, "Options:\n");
-	fprintf(stderr, "  -h, --help        show this help\n");
-	fprintf(stderr, "  -a, --alignment   set parameter for .align\n");
-	fprintf(stderr, "      --apple-llvm  output for apple assembler\n");
-	fprintf(stderr, "  -H, --header      output C header\n");
+	gt_printf(log, "%s\n", PACKAGE_STRING );
+	gt_printf(log, "%s - convert binary files to assembly language\n", name);
+
+	gt_printf(log, "usage: %s [option ...] [binary files ...]\n", name);
+	gt_printf(log, "       %s --serve [socket]\n", name);
+
+	gt_printf(log, "Options:\n");
+	gt_printf(log, "  -h, --help        show this help\n");
+	gt_printf(log, "  -a, --alignment   set parameter for .align\n");
+	gt_printf(log, "      --apple-llvm  output for apple assembler\n");
+	gt_printf(log, "  -H, --header      output C header\n");
+	gt_printf(log, "  -o, --output-dir  write a .s per file to this directory instead of stdout\n");
+	gt_printf(log, "  -s, --shard-size  with -o, split files larger than this many MB into\n");
+	gt_printf(log, "                    several .s, to be linked in order\n");
+	gt_printf(log, "  -M, --objects     with -o, write a make fragment adding the objects\n");
+	gt_printf(log, "                    to BIN2S_OBJECTS\n");
+	gt_printf(log, "      --serve       take jobs as JSON lines from stdin or a Unix socket\n");
+	gt_printf(log, "      --stats[=file] time spent per phase, to stderr or appended to file\n");
 
 }
 
 //---------------------------------------------------------------------------------
-int main(int argc, char **argv) {
+static int parse(int argc, char **argv, const gt_sink *log, void **job) {
 //---------------------------------------------------------------------------------
-	FILE *fin;
-	FILE *header_file;
+	bin2s_job *b;
+	static int apple_llvm;
+	int alignment = 4;
 	char *header_name = NULL;
+	char *output_dir = NULL;
+	char *objects_name = NULL;
+	unsigned long shard_size = 0;
 
-	size_t filelen;
-	int linelen;
-	int arg;
-	int alignment = 4;
-	static int apple_llvm = 0;
-	static int output_header = 0;
+	*job = NULL;
 
 	if(argc < 2) {
-		showhelp(argv[0]);
+		showhelp(log, argv[0]);
 		return -1;
 	}
 
 	int c;
 
+	apple_llvm = 0;
+	optind = 0;		/* start over, the server parses many command lines */
+
 	while (1) {
 		static struct option long_options[] = {
 			{"apple-llvm", no_argument,       &apple_llvm,   1},
 			{"header",     required_argument, 0,           'H'},
 			{"alignment",  no_argument,       0,           'a'},
+			{"output-dir", required_argument, 0,           'o'},
+			{"shard-size", required_argument, 0,           's'},
+			{"objects",    required_argument, 0,           'M'},
 			{"help",       no_argument,       0,           'h'},
 			{0, 0, 0, 0}
 		};
 
 		int option_index = 0;
 
-		c = getopt_long (argc, argv, "a:hH:",
+		c = getopt_long (argc, argv, "a:hH:o:s:M:",
 			long_options, &option_index);
 		if (c == -1)
 			break;
@@ -141,7 +133,7 @@ int main(int argc, char **argv) {
 		switch(c) {
 
 			case 'h':
-			showhelp(argv[0]);
+			showhelp(log, argv[0]);
 			return 0;
 
 			case 'a':
@@ -149,42 +141,124 @@ int main(int argc, char **argv) {
 			break;
 
 			case 'H':
-			header_name = strdup(optarg);
-			output_header = 1;
+			header_name = optarg;
+			break;
+
+			case 'o':
+			output_dir = optarg;
+			break;
+
+			case 's':
+			shard_size = strtoul(optarg,0,0) * 1024 * 1024;
+			break;
+
+			case 'M':
+			objects_name = optarg;
 			break;
 
 			case '?':
-			if (optopt == 'a' || optopt == 'H')
-				fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+			if (optopt == 'a' || optopt == 'H' || optopt == 'o' || optopt == 's' || optopt == 'M')
+				gt_printf (log, "Option -%c requires an argument.\n", optopt);
 			else if (isprint (optopt))
-				fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				gt_printf (log, "Unknown option `-%c'.\n", optopt);
 			else
-				fprintf (stderr, "Unknown option character `\\x%x'.\n",optopt);
+				gt_printf (log, "Unknown option character `\\x%x'.\n",optopt);
 			return 1;
 		}
 	}
 
-	if (output_header) {
-		header_file = fopen(header_name, "wb");
+	if ((shard_size || objects_name) && !output_dir) {
+		gt_printf(log, "bin2s: -s and -M need an output directory (-o)\n");
+		return 1;
+	}
+
+	b = (bin2s_job *)malloc(sizeof(bin2s_job));
+	if (!b) return 1;
+
+	b->files = argv + optind;
+	b->count = argc - optind;
+	b->header_name = header_name;
+	b->output_dir = output_dir;
+	b->objects_name = objects_name;
+	b->shard_size = shard_size;
+	b->alignment = alignment;
+	b->apple_llvm = apple_llvm;
+
+	*job = b;
+	return 0;
+}
+
+//---------------------------------------------------------------------------------
+static int outputs(void *job, const char **names, int max) {
+//---------------------------------------------------------------------------------
+	bin2s_job *b = (bin2s_job *)job;
+	int count = 0;
+
+	/* the .s names depend on the sizes of the files, give the directory */
+	if (b->header_name && count < max) names[count++] = b->header_name;
+	if (b->objects_name && count < max) names[count++] = b->objects_name;
+	if (b->output_dir && count < max) names[count++] = b->output_dir;
+	return count;
+}
+
+//---------------------------------------------------------------------------------
+static int convert(bin2s_job *b, const gt_sink *out, const gt_sink *log, gt_stats *stats, unsigned char *inbuf, binformat *fmt) {
+//---------------------------------------------------------------------------------
+	FILE *fin;
+	FILE *header_file = NULL;
+	FILE *objects_file = NULL;
+	FILE *shard_file = NULL;
+
+	size_t filelen;
+	int arg;
+	char ident[256];
+	char shard_name[FILENAME_MAX];
+	gt_sink header_file_sink, shard_file_sink;
+	gt_stats_sink out_stats, header_stats, shard_stats;
+	const gt_sink *header = NULL;
+	const gt_sink *dest;
+	int status = 1;
+
+	out = gt_stats_wrap(&out_stats, stats, out);
+
+	if (b->header_name) {
+		gt_stats_phase(stats, GT_OPEN);
+		if (stats) stats->opens++;
+		header_file = fopen(b->header_name, "wb");
 		if(!header_file) {
-			fprintf(stderr,"bin2s: could not create %s\n", header_name);
-			perror(header_name);
+			gt_printf(log, "bin2s: could not create %s\n", b->header_name);
+			gt_printf(log, "%s: %s\n", b->header_name, strerror(errno));
 			return 1;
 		}
-		fprintf(header_file, "/* Generated by BIN2S - please don't edit directly */\n");
-		fprintf(header_file, "#pragma once\n");
-		fprintf(header_file, "#include <stddef.h>\n");
-		fprintf(header_file, "#include <stdint.h>\n\n");
+		gt_file_sink(&header_file_sink, header_file);
+		header = gt_stats_wrap(&header_stats, stats, &header_file_sink);
+		gt_stats_phase(stats, GT_FORMAT);
+		gt_bin2s_header_begin(header);
 	}
 
-	for(arg = optind; arg < argc; arg++) {
+	if (b->objects_name) {
+		gt_stats_phase(stats, GT_OPEN);
+		if (stats) stats->opens++;
+		objects_file = fopen(b->objects_name, "w");
+		if(!objects_file) {
+			gt_printf(log, "bin2s: could not create %s: %s\n", b->objects_name, strerror(errno));
+			goto done;
+		}
+		fprintf(objects_file, "# Generated by BIN2S - please don't edit directly\n");
+	}
 
-		fin = fopen(argv[arg], "rb");
+	for(arg = 0; arg < b->count; arg++) {
+
+		gt_stats_phase(stats, GT_OPEN);
+		if (stats) {
+			stats->opens++;
+			stats->seeks += 2;
+		}
+		fin = fopen(b->files[arg], "rb");
 
 		if(!fin) {
-			fputs("bin2s: could not open ", stderr);
-			perror(argv[arg]);
-			return 1;
+			gt_printf(log, "bin2s: could not open %s: %s\n", b->files[arg], strerror(errno));
+			goto done;
 		}
 
 		fseek(fin, 0, SEEK_END);
@@ -193,11 +267,11 @@ int main(int argc, char **argv) {
 
 		if(filelen == 0) {
 			fclose(fin);
-			fprintf(stderr, "bin2s: warning: skipping empty file %s\n", argv[arg]);
+			gt_printf(log, "bin2s: warning: skipping empty file %s\n", b->files[arg]);
 			continue;
 		}
 
-		char *ptr = argv[arg];
+		char *ptr = b->files[arg];
 		char chr;
 		char *filename = NULL;
 
@@ -214,81 +288,152 @@ int main(int argc, char **argv) {
 		if ( NULL != filename ) { 
 			filename++;
 		} else {
-			filename = argv[arg];
+			filename = b->files[arg];
 		}
 
-	/*---------------------------------------------------------------------------------
-		Generate the prolog for each included file.  It has two purposes:
-
-		1. provide length info, and
-		2. align to user defined boundary, default is 32bit
-
-	---------------------------------------------------------------------------------*/
-		fprintf( stdout, "/* Generated by BIN2S - please don't edit directly */\n");
-
-		if (apple_llvm) {
-			fprintf( stdout, "\t.const_data\n");
-		} else {
-			fprintf( stdout,"\t.section .rodata.%s, \"a\"\n", strnident(filename, apple_llvm) );
-		}
+		binformat_ident(filename, b->apple_llvm, ident, sizeof(ident));
+
+		/* with -o, files over the shard size become balanced shards in one section */
+		unsigned int shards = 1, shard;
+		if (b->output_dir && b->shard_size && filelen > b->shard_size)
+			shards = (filelen + b->shard_size - 1) / b->shard_size;
+
+		for (shard = 0; shard < shards; shard++) {
+			size_t start = (unsigned long long)filelen * shard / shards;
+			size_t count = (unsigned long long)filelen * (shard + 1) / shards - start;
+			int last = shard == shards - 1;
+
+			dest = out;
+			if (b->output_dir) {
+				if (shards > 1)
+					snprintf(shard_name, sizeof(shard_name), "%s/%s.%u.s", b->output_dir, ident, shard);
+				else
+					snprintf(shard_name, sizeof(shard_name), "%s/%s.s", b->output_dir, ident);
+
+				gt_stats_phase(stats, GT_OPEN);
+				if (stats) stats->opens++;
+				shard_file = fopen(shard_name, "wb");
+				if(!shard_file) {
+					gt_printf(log, "bin2s: could not create %s: %s\n", shard_name, strerror(errno));
+					fclose(fin);
+					goto done;
+				}
+				gt_file_sink(&shard_file_sink, shard_file);
+				dest = gt_stats_wrap(&shard_stats, stats, &shard_file_sink);
+			}
 
-		fprintf( stdout, "\t.balign %d\n", alignment);
-		fputs("\t.global ", stdout);
-		fputs(strnident(filename, apple_llvm), stdout);
-		fputs("\n", stdout);
-		fputs(strnident(filename, apple_llvm), stdout);
-		fputs(":\n\t.byte ", stdout);
+			gt_stats_phase(stats, GT_FORMAT);
+			if (b->output_dir)
+				binformat_asm_shard_begin(dest, ident, shard, last, b->alignment, b->apple_llvm);
+			else
+				binformat_asm_begin(dest, ident, b->alignment, b->apple_llvm);
 
-		linelen = 0;
+			binformat_init(fmt, dest, BINFORMAT_ASM, count);
 
-		int count = filelen;
+			while(count > 0) {
+				gt_stats_phase(stats, GT_READ);
+				size_t len = fread(inbuf, 1, count < BINFORMAT_BUFSIZE ? count : BINFORMAT_BUFSIZE, fin);
+				if (stats) {
+					stats->reads++;
+					stats->bytesIn += len;
+				}
 
-		while(count > 0) {
-			unsigned char c = fgetc(fin);
+				/* a short file still gets all the items it claimed */
+				if(len == 0) {
+					len = count < BINFORMAT_BUFSIZE ? count : BINFORMAT_BUFSIZE;
+					memset(inbuf, 0xff, len);
+				}
 
-			printf("%3u", (unsigned int)c);
-			count--;
+				gt_stats_phase(stats, GT_FORMAT);
+				binformat_data(fmt, inbuf, len);
+				count -= len;
+			}
+			binformat_flush(fmt);
 
-			/* don't put a comma after the last item */
-			if(count) {
+			if (last)
+				binformat_asm_end(dest, ident, filelen, !b->header_name);
+			else
+				binformat_asm_shard_end(dest);
+
+			if (shard_file) {
+				/* a file of its own, end the last line */
+				gt_printf(dest, "\n");
+				gt_stats_phase(stats, GT_WRITE);
+				int err = fclose(shard_file);
+				shard_file = NULL;
+				if (err) {
+					gt_printf(log, "bin2s: could not write %s: %s\n", shard_name, strerror(errno));
+					fclose(fin);
+					goto done;
+				}
 
-				/* break after every 16th number */
-				if(++linelen >= 16) {
-					linelen = 0;
-					fputs("\n\t.byte ", stdout);
-				} else {
-					fputc(',', stdout);
+				/* the object the rules make from the .s */
+				if (objects_file) {
+					strcpy(shard_name + strlen(shard_name) - 1, "o");
+					fprintf(objects_file, "BIN2S_OBJECTS += %s\n", shard_name);
 				}
 			}
 		}
 
-		fputs("\n\n\t.global ", stdout);
-		fputs(strnident(filename, apple_llvm), stdout);
-		fputs("_end\n", stdout);
-		fputs(strnident(filename, apple_llvm), stdout);
-		fputs("_end:\n\n", stdout);
-
-		if (output_header) {
-			fprintf(header_file, "extern const uint8_t %s[];\n", strnident(filename, 0));
-			fprintf(header_file, "extern const uint8_t %s_end[];\n", strnident(filename, 0));
-			fprintf(header_file, "#if __cplusplus >= 201103L\n");
-			fprintf(header_file, "static constexpr size_t %s_size=%lu;\n", strnident(filename, 0), (unsigned long)filelen);
-			fprintf(header_file, "#else\n");
-			fprintf(header_file, "static const size_t %s_size=%lu;\n", strnident(filename, 0), (unsigned long)filelen);
-			fprintf(header_file, "#endif\n");
-		} else {
-			fprintf(stdout,"\t.global ");
-			fputs(strnident(filename, apple_llvm), stdout);
-			fputs("_size\n", stdout);
-			fputs("\t.balign 4\n",stdout);
-			fputs(strnident(filename, apple_llvm), stdout);
-			fprintf( stdout, "_size: .int %lu\n", (unsigned long)filelen);
+		if (b->header_name) {
+			gt_stats_phase(stats, GT_FORMAT);
+			binformat_asm_header(header, binformat_ident(filename, 0, ident, sizeof(ident)), filelen);
 		}
 
-		fputs("\n\n#if defined(__linux__) && defined(__ELF__)\n.section .note.GNU-stack,\"\",%progbits\n#endif", stdout);
 		fclose(fin);
 	}
 
-	if(output_header) fclose(header_file);
-	return 0;
+	status = 0;
+
+done:
+	gt_stats_phase(stats, GT_WRITE);
+	if(objects_file && fclose(objects_file) != 0 && status == 0) {
+		gt_printf(log, "bin2s: could not write %s: %s\n", b->objects_name, strerror(errno));
+		status = 1;
+	}
+	if(header_file) fclose(header_file);
+	return status;
+}
+
+//---------------------------------------------------------------------------------
+static int run(void *job, const gt_sink *out, const gt_sink *log, gt_stats *stats) {
+//---------------------------------------------------------------------------------
+	bin2s_job *b = (bin2s_job *)job;
+	unsigned char *inbuf = (unsigned char *)malloc(BINFORMAT_BUFSIZE);
+	binformat *fmt = (binformat *)malloc(sizeof(binformat));
+	int status = 1;
+
+	if (inbuf && fmt) status = convert(b, out, log, stats, inbuf, fmt);
+
+	free(fmt);
+	free(inbuf);
+	free(b);
+	return status;
+}
+
+static const gt_tool tool = { "bin2s", parse, outputs, run };
+
+//---------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//---------------------------------------------------------------------------------
+	gt_sink out, log;
+	gt_stats stats;
+	const char *stats_to;
+	void *job;
+	int status;
+
+	if (argc > 1 && !strcmp(argv[1], "--serve")) return gt_serve(&tool, argc > 2 ? argv[2] : NULL, 0);
+
+	stats_to = gt_stats_option(&argc, argv);
+	gt_stats_init(&stats);
+
+	gt_file_sink(&out, stdout);
+	gt_file_sink(&log, stderr);
+
+	status = parse(argc, argv, &log, &job);
+	if (!job) return status;
+
+	status = run(job, &out, &log, stats_to ? &stats : NULL);
+	gt_stats_report(&stats, "bin2s", stats_to);
+	return status;
 }
@@ -0,0 +1,221 @@
+/*---------------------------------------------------------------------------------
+
+binformat: format binary data as gcc assembly (bin2s) or C source (raw2c)
+
+Items are formatted straight into a buffer instead of going through printf for
+every byte, the output is identical to what bin2s and raw2c always wrote.
+
+---------------------------------------------------------------------------------*/
+
+#include <ctype.h>
+#include <string.h>
+
+#include "binformat.h"
+
+static const char hexdigits[] = "0123456789abcdef";
+
+static const char asm_comment[] = "/* Generated by BIN2S - please don't edit directly */\n";
+static const char asm_stack_note[] = "\n\n#if defined(__linux__) && defined(__ELF__)\n.section .note.GNU-stack,\"\",%progbits\n#endif";
+static const char c_head[] = "/*\n  This file was autogenerated by raw2c.\nVisit http://www.devkitpro.org\n*/\n\n";
+static const char c_comment[] = "//---------------------------------------------------------------------------------\n";
+
+/*---------------------------------------------------------------------------------
+Print the closest valid C identifier to a given word.
+---------------------------------------------------------------------------------*/
+char *binformat_ident(const char *src, int apple_llvm, char *buf, size_t size) {
+//---------------------------------------------------------------------------------
+	char got_first = 0;
+	char *p = buf;
+	char *end = buf + size - 1;
+
+	while(*src != 0 && p < end) {
+
+		int s = (unsigned char)*src++;
+
+		/* prepend _ for apple-llvm mode or initial digit  */
+		if((isdigit(s) || apple_llvm) && !got_first)
+		*p++ = '_';  /* stick a '_' before an initial digit */
+
+		/* convert only out-of-range characters */
+		if(!isalpha(s) && !isdigit(s) && (s != '_')) {
+			if(s == '-' || s == '.' || s == '/') s = '_';
+			else
+				s = 0;
+		}
+
+		if(s && p < end) {
+			*p++ = s;
+			got_first = 1;
+		}
+	}
+	*p = 0;
+	return buf;
+}
+
+//---------------------------------------------------------------------------------
+void binformat_init(binformat *f, const gt_sink *out, int style, unsigned long length) {
+//---------------------------------------------------------------------------------
+	f->out = *out;
+	f->style = style;
+	f->length = length;
+	f->count = 0;
+	f->used = 0;
+	f->error = 0;
+}
+
+//---------------------------------------------------------------------------------
+int binformat_flush(binformat *f) {
+//---------------------------------------------------------------------------------
+	if (f->used && f->out.write(f->out.context, f->buf, f->used)) f->error = 1;
+	f->used = 0;
+	return f->error ? -1 : 0;
+}
+
+//---------------------------------------------------------------------------------
+void binformat_data(binformat *f, const void *data, size_t len) {
+//---------------------------------------------------------------------------------
+	const unsigned char *src = (const unsigned char *)data;
+
+	while(len--) {
+
+		unsigned int c = *src++;
+		char *p;
+
+		/* longest item plus separator is 16 characters */
+		if (f->used > BINFORMAT_BUFSIZE - 16) binformat_flush(f);
+		p = f->buf + f->used;
+
+		f->count++;
+
+		if (f->style == BINFORMAT_ASM) {
+
+			/* "%3u", no comma after the last item, break after every 16th number */
+			*p++ = c >= 100 ? '0' + c / 100 : ' ';
+			*p++ = c >= 10 ? '0' + (c / 10) % 10 : ' ';
+			*p++ = '0' + c % 10;
+
+			if (f->count < f->length) {
+				if (!(f->count % 16)) {
+					memcpy(p, "\n\t.byte ", 8);
+					p += 8;
+				} else {
+					*p++ = ',';
+				}
+			}
+		} else {
+
+			/* "0x%02x", line break after every 16th item */
+			*p++ = '0';
+			*p++ = 'x';
+			*p++ = hexdigits[c >> 4];
+			*p++ = hexdigits[c & 15];
+
+			if (f->count < f->length) {
+				*p++ = ',';
+				*p++ = ' ';
+			}
+
+			if (!(f->count % 16)) {
+				*p++ = '\n';
+				*p++ = '\t';
+			}
+		}
+
+		f->used = p - f->buf;
+	}
+}
+
+/*---------------------------------------------------------------------------------
+	Generate the prolog for each included file.  It has two purposes:
+
+	1. provide length info, and
+	2. align to user defined boundary, default is 32bit
+
+---------------------------------------------------------------------------------*/
+int binformat_asm_begin(const gt_sink *out, const char *ident, int alignment, int apple_llvm) {
+//---------------------------------------------------------------------------------
+	if (apple_llvm) {
+		return gt_printf(out, "%s\t.const_data\n\t.balign %d\n\t.global %s\n%s:\n\t.byte ",
+			asm_comment, alignment, ident, ident);
+	}
+
+	return gt_printf(out, "%s\t.section .rodata.%s, \"a\"\n\t.balign %d\n\t.global %s\n%s:\n\t.byte ",
+		asm_comment, ident, alignment, ident, ident);
+}
+
+//---------------------------------------------------------------------------------
+int binformat_asm_end(const gt_sink *out, const char *ident, unsigned long length, int size_symbol) {
+//---------------------------------------------------------------------------------
+	int err = gt_printf(out, "\n\n\t.global %s_end\n%s_end:\n\n", ident, ident);
+
+	if (size_symbol) {
+		err |= gt_printf(out, "\t.global %s_size\n\t.balign 4\n%s_size: .int %lu\n", ident, ident, length);
+	}
+
+	return err | gt_printf(out, "%s", asm_stack_note);
+}
+
+//---------------------------------------------------------------------------------
+int binformat_asm_shard_begin(const gt_sink *out, const char *ident, unsigned int shard, int last, int alignment, int apple_llvm) {
+//---------------------------------------------------------------------------------
+	int err;
+
+	if (shard == 0) {
+		if (apple_llvm) {
+			err = gt_printf(out, "%s\t.const_data\n\t.balign %d\n\t.global %s\n%s:\n",
+				asm_comment, alignment, ident, ident);
+		} else {
+			err = gt_printf(out, "%s\t.section .rodata.%s, \"a\"\n\t.balign %d\n\t.global %s\n%s:\n",
+				asm_comment, ident, alignment, ident, ident);
+		}
+	} else {
+		/* no alignment: the shard follows the previous one without padding */
+		if (apple_llvm) {
+			err = gt_printf(out, "%s\t.const_data\n\t.global %s_shard%u\n%s_shard%u:\n",
+				asm_comment, ident, shard, ident, shard);
+		} else {
+			err = gt_printf(out, "%s\t.section .rodata.%s, \"a\"\n\t.global %s_shard%u\n%s_shard%u:\n",
+				asm_comment, ident, ident, shard, ident, shard);
+		}
+	}
+
+	/* nothing refers to the later shards, the reloc keeps --gc-sections from dropping them */
+	if (!last && !apple_llvm) err |= gt_printf(out, "\t.reloc ., BFD_RELOC_NONE, %s_shard%u\n", ident, shard + 1);
+
+	return err | gt_printf(out, "%s", "\t.byte ");
+}
+
+//---------------------------------------------------------------------------------
+int binformat_asm_shard_end(const gt_sink *out) {
+//---------------------------------------------------------------------------------
+	return gt_printf(out, "\n%s", asm_stack_note);
+}
+
+//---------------------------------------------------------------------------------
+int binformat_asm_header(const gt_sink *header, const char *ident, unsigned long length) {
+//---------------------------------------------------------------------------------
+	return gt_printf(header,
+		"extern const uint8_t %s[];\n"
+		"extern const uint8_t %s_end[];\n"
+		"#if __cplusplus >= 201103L\n"
+		"static constexpr size_t %s_size=%lu;\n"
+		"#else\n"
+		"static const size_t %s_size=%lu;\n"
+		"#endif\n", ident, ident, ident, length, ident, length);
+}
+
+//---------------------------------------------------------------------------------
+int binformat_c_begin(const gt_sink *source, const gt_sink *header, const char *name) {
+//---------------------------------------------------------------------------------
+	int err = gt_printf(header, "%s%s#ifndef _%s_h_\n#define _%s_h_\n%s", c_head, c_comment, name, name, c_comment);
+	err |= gt_printf(header, "extern const unsigned char %s[];\nextern const int %s_size;\n%s", name, name, c_comment);
+	err |= gt_printf(header, "#endif //_%s_h_\n%s", name, c_comment);
+
+	return err | gt_printf(source, "%sconst unsigned char %s[] = {\n\t", c_head, name);
+}
+
+//---------------------------------------------------------------------------------
+int binformat_c_end(const gt_sink *source, const char *name) {
+//---------------------------------------------------------------------------------
+	return gt_printf(source, "\n};\nconst int %s_size = sizeof(%s);\n", name, name);
+}
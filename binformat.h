@@ -0,0 +1,57 @@
+/*---------------------------------------------------------------------------------
+
+binformat: format binary data as gcc assembly (bin2s) or C source (raw2c)
+
+---------------------------------------------------------------------------------*/
+#ifndef _binformat_h_
+#define _binformat_h_
+
+#include "generaltools.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BINFORMAT_ASM		0	/* .byte lines, as written by bin2s */
+#define BINFORMAT_C		1	/* array initializer, as written by raw2c */
+
+#define BINFORMAT_BUFSIZE	65536
+
+typedef struct {
+	gt_sink		out;
+	int		style;
+	unsigned long	length;		/* total number of bytes */
+	unsigned long	count;		/* bytes formatted so far */
+	size_t		used;		/* characters waiting in buf */
+	int		error;		/* a write to out failed */
+	char		buf[BINFORMAT_BUFSIZE];
+} binformat;
+
+/* closest valid C identifier to a given word, written to buf */
+char *binformat_ident(const char *src, int apple_llvm, char *buf, size_t size);
+
+/* data: length must be known up front, the separators depend on it */
+void binformat_init(binformat *f, const gt_sink *out, int style, unsigned long length);
+void binformat_data(binformat *f, const void *data, size_t len);
+int binformat_flush(binformat *f);		/* 0 if everything was written */
+
+/* bin2s module around the data, these return 0 on success */
+int binformat_asm_begin(const gt_sink *out, const char *ident, int alignment, int apple_llvm);
+int binformat_asm_end(const gt_sink *out, const char *ident, unsigned long length, int size_symbol);
+int binformat_asm_header(const gt_sink *header, const char *ident, unsigned long length);
+
+/* one piece of a module split into several: shard 0 starts ident, the last shard
+   ends with binformat_asm_end, the others with binformat_asm_shard_end. The shards
+   share a section and must be linked in order */
+int binformat_asm_shard_begin(const gt_sink *out, const char *ident, unsigned int shard, int last, int alignment, int apple_llvm);
+int binformat_asm_shard_end(const gt_sink *out);
+
+/* raw2c source and header around the data */
+int binformat_c_begin(const gt_sink *source, const gt_sink *header, const char *name);
+int binformat_c_end(const gt_sink *source, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _binformat_h_ */
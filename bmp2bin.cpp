@@ -21,537 +21,363 @@
 //////////////////////////////////////////////////////////////////////////////
 // Includes                                                                 //
 //////////////////////////////////////////////////////////////////////////////
-#include <stdio.h>
-#include <sys/param.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <sys/stat.h>
+#include "bmp2bin.h"
 //////////////////////////////////////////////////////////////////////////////
 // Defines                                                                  //
 //////////////////////////////////////////////////////////////////////////////
 #define VER                                     "1.08"
 #define VERF                                    "1.05"
-#define ALIGN4(n)                       (((n)+3) &~ 3)
-
 
 //////////////////////////////////////////////////////////////////////////////
-// Typedefs                                                                 //
+// Variables                                                                //
 //////////////////////////////////////////////////////////////////////////////
-typedef unsigned char BYTE;
-typedef unsigned short WORD;
-typedef unsigned int DWORD;
-typedef int LONG;
-
-//
-// Convert Little Endian to Big Endian..
-//
-
-/*static BYTE endiaB( BYTE b ) {
-        return b;
-}
-*/
-static WORD endiaW( WORD w ) {
-#if BYTE_ORDER == BIG_ENDIAN
-        WORD rw;
-        rw = ((w >> 8) | (w << 8));
-        //printf("%04x -> %04x\n",w,rw);
-        return rw;
-#elif BYTE_ORDER == LITTLE_ENDIAN
-        return w;
-#else
-#error unknown endianess..
-#endif
-
-}
-
-static DWORD endiaDW( DWORD w ) {
-#if BYTE_ORDER == BIG_ENDIAN
-        DWORD rw;
-        WORD wu = w >> 16;
-        WORD wl = w & 0xffff;
-        wu = (wu >> 8) | (wu << 8);
-        wl = (wl >> 8) | (wl << 8);
-        rw = ((wl << 16) | (wu));
-        //printf("%08x -> %08x\n",w,rw);
-        return rw;
-#elif BYTE_ORDER == LITTLE_ENDIAN
-        return w;
-#else
-#error unknown endianess..
-#endif
-}
-
-static LONG endiaL( LONG w ) {
-#if BYTE_ORDER == BIG_ENDIAN
-        LONG rw;
-        WORD wu = (WORD)(w >> 16);
-        WORD wl = (WORD)(w & 0xffff);
-        wu = (wu >> 8) | (wu << 8);
-        wl = (wl >> 8) | (wl << 8);
-        rw = ((wl << 16) | (wu));
-        //printf("%08x -> %08x\n",w,rw);
-        return rw;
-#elif BYTE_ORDER == LITTLE_ENDIAN
-        return w;
-#else
-#error unknown endianess..
-#endif
-}
-
-//
-//
-//
-
-#pragma pack(1)
-
-typedef struct tagRGBTRIPLE {
-        BYTE    rgbtBlue;
-        BYTE    rgbtGreen;
-        BYTE    rgbtRed;
-} RGBTRIPLE;
-
-typedef struct tagRGBQUAD {
-        BYTE    rgbBlue;
-        BYTE    rgbGreen;
-        BYTE    rgbRed;
-        BYTE    rgbReserved;
-} RGBQUAD;
-
-typedef struct tagBITMAPFILEHEADER {    // size 14 bytes
-        WORD    bfType;
-        DWORD   bfSize;
-        WORD    bfReserved1;
-        WORD    bfReserved2;
-        DWORD   bfOffBits;
-} BITMAPFILEHEADER;
-
-typedef struct tagBITMAPINFOHEADER{             // size 40 bytes
-        DWORD      biSize;
-        LONG       biWidth;
-        LONG       biHeight;
-        WORD       biPlanes;
-        WORD       biBitCount;
-        DWORD      biCompression;
-        DWORD      biSizeImage;
-        LONG       biXPelsPerMeter;
-        LONG       biYPelsPerMeter;
-        DWORD      biClrUsed;
-        DWORD      biClrImportant;
-} BITMAPINFOHEADER;
-
-#pragma pack()
-
-typedef void WritePixel(const RGBTRIPLE *p);
+struct CachedPalette
+{
+        Palette *palette;
+        time_t  mtime;                          // file state when it was read
+        off_t   size;
+};
+static std::map<std::string, CachedPalette> paletteCache; // loaded palettes by file name
+static std::vector<Palette *> oldPalettes;      // replaced, but maybe still used by running jobs
+static std::mutex paletteMutex;
 
 //////////////////////////////////////////////////////////////////////////////
-// Variables                                                                //
+// LoadPalette                                                              //
 //////////////////////////////////////////////////////////////////////////////
-static char *inputFile;
-static char *outputFile;
-static char *paletteFile;
-static char *outPaletteFile ;
-static RGBTRIPLE palette[256];
-static RGBTRIPLE *imageData;
-static BITMAPFILEHEADER bfh;
-static BITMAPINFOHEADER bih;
-static char flags[256];
-static WritePixel *writePixel;          // pixel write function
-static FILE *fi;
-static FILE *fo;
-static FILE *fp = NULL;
-
-//
-//
-//
-
-static int writePaletteGP( RGBQUAD* p, int fmt, FILE *fp ) {
-        int m,n;
-        RGBQUAD q;
-
-        for (n = 0; n < 256; n += 16 ) {
-                for (m = 0; m < 16; m++) {
-                        q = p[n+m];
-                //      printf("%02x %02x %02x - %04x %04x %04x\n",
-                //                      q.rgbRed,q.rgbGreen,q.rgbBlue,
-                //                      q.rgbRed>>3<<11,q.rgbGreen>>2<<5,q.rgbBlue>>3);
-
-                        fprintf(fp,"0x%04x",(q.rgbBlue>>3<<1) | (q.rgbGreen>>3<<6) | (q.rgbRed>>3<<11));
-                        if (m < 15) {
-                                fprintf(fp,",");
-                        } else {
-                                fprintf(fp,"\n");
-                        }
+const Palette *LoadPalette(const char *paletteFile, const gt_sink *log)
+{                                               // each palette file is only read once per process, unless it changes
+        std::lock_guard<std::mutex> lock(paletteMutex);
 
-                }
-        }
-        return 0;
-}
+        struct stat st;
+        if (stat(paletteFile, &st) != 0) { gt_printf(log, "Error opening palette file!\n"); return NULL; }
 
+        std::map<std::string, CachedPalette>::iterator cached = paletteCache.find(paletteFile);
+        if (cached != paletteCache.end())
+        {
+                if (cached->second.mtime == st.st_mtime && cached->second.size == st.st_size) return cached->second.palette;
+                oldPalettes.push_back(cached->second.palette);
+                paletteCache.erase(cached);
+        }
 
+        // open palette file
+        FILE *f = fopen(paletteFile, "rb");
+        if (!f) { gt_printf(log, "Error opening palette file!\n"); return NULL; }
 
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
 
-//////////////////////////////////////////////////////////////////////////////
-// Sqr                                                                      //
-//////////////////////////////////////////////////////////////////////////////
-inline unsigned long Sqr(unsigned int n)
-{
-        return n*n;
-}
+        // read data, in one go
+        std::vector<BYTE> data(size + 1);
+        size = fread(&data[0], 1, size, f);
 
-//////////////////////////////////////////////////////////////////////////////
-// Dist1                                                                    //
-//////////////////////////////////////////////////////////////////////////////
-unsigned long Dist1(const RGBTRIPLE *a, const RGBTRIPLE *b)
-{
-        return
-        (
-                Sqr((int)a->rgbtRed - (int)b->rgbtRed)*28 +
-                Sqr((int)a->rgbtGreen - (int)b->rgbtGreen)*91 +
-                Sqr((int)a->rgbtBlue - (int)b->rgbtBlue)*9
-        );
-}
+        // close file
+        fclose(f);
 
-//////////////////////////////////////////////////////////////////////////////
-// WritePixelP1                                                             //
-//////////////////////////////////////////////////////////////////////////////
-void WritePixelP1(const RGBTRIPLE *p)           // '1': 8 bits palette (method 1)
-{
-        unsigned char out;
-        unsigned long bestDist = (unsigned long)-1;
-        
-        for (int i=0; i<256; i++)
+        Palette *palette = new Palette;
+        if (!ParsePalette(&data[0], size, palette))
         {
-                unsigned long dist = Dist1(p, &palette[i]);
-                if (dist < bestDist) { bestDist = dist; out = i; }
+                gt_printf(log, "Unknown palette format!\n");
+                delete palette;
+                return NULL;
         }
-        
-        fwrite(&out, 1, 1, fo);
-}
-
-//////////////////////////////////////////////////////////////////////////////
-// WritePixel24                                                             //
-//////////////////////////////////////////////////////////////////////////////
-void WritePixel24(const RGBTRIPLE *p)   // 't': 24 bits
-{
-        fwrite(&p->rgbtRed, 1, 1, fo);
-        fwrite(&p->rgbtGreen, 1, 1, fo);
-        fwrite(&p->rgbtBlue, 1, 1, fo);
-}
-
-//////////////////////////////////////////////////////////////////////////////
-// WritePixel8                                                              //
-//////////////////////////////////////////////////////////////////////////////
-void WritePixel8(const RGBTRIPLE *p)            // 'e': 8 bits (b2g3r3)
-{
-        unsigned char out = (p->rgbtBlue>>6<<6) | (p->rgbtGreen>>5<<3) | (p->rgbtRed>>5<<0);
-        fwrite(&out, 1, 1, fo);
-}
 
-//////////////////////////////////////////////////////////////////////////////
-// WritePixelGP8                                                            //
-//////////////////////////////////////////////////////////////////////////////
-void WritePixelGP8(const RGBTRIPLE *p)          // 'i': 8 bits (LUT, GamePark)
-{
-        unsigned char out = p->rgbtRed;
- // hack by Mr.Spiv
-        fwrite(&out, 1, 1, fo);
+        CachedPalette entry = { palette, st.st_mtime, st.st_size };
+        paletteCache[paletteFile] = entry;
+        return palette;
 }
 
 //////////////////////////////////////////////////////////////////////////////
-// WritePixelGP32                                                           //
+// ConvertFile                                                              //
 //////////////////////////////////////////////////////////////////////////////
-void WritePixelGP32(const RGBTRIPLE *p)         // 'p': 16 bits (r5g5b5x1, GamePark)
+int ConvertFile(Job *job)
 {
-        unsigned short out = endiaW((p->rgbtBlue>>3<<1) | (p->rgbtGreen>>3<<6) | (p->rgbtRed>>3<<11));
-        fwrite(&out, 2, 1, fo);
-}
-
-//////////////////////////////////////////////////////////////////////////////
-// WritePixelGP2X                                                           //
-//////////////////////////////////////////////////////////////////////////////
-void WritePixelGP2X(const RGBTRIPLE *p)         // '2': 16 bits (r5g6b5, GP2X)
-{
-        unsigned short out = endiaW((p->rgbtBlue>>3) | ((p->rgbtGreen&0xFC) << 3) | ((p->rgbtRed&0xF8)<<8));
-        fwrite(&out, 2, 1, fo);
-}
+        if (job->paletteFile)
+        {
+                gt_stats_phase(job->stats, GT_OPEN);
+                job->palette = LoadPalette(job->paletteFile, job->log);
+                if (!job->palette) return -1;
+        }
 
-//////////////////////////////////////////////////////////////////////////////
-// WritePixelGB                                                             //
-//////////////////////////////////////////////////////////////////////////////
-void WritePixelGB(const RGBTRIPLE *p)           // 'g': 16 bits (x1b5g5r5, GameBoy)
-{
-        unsigned short out = (p->rgbtBlue>>3<<10) | (p->rgbtGreen>>3<<5) | (p->rgbtRed>>3<<0);
-        if ( flags['d']) out |= 0x8000;
-        fwrite(&out, 2, 1, fo);
+        return Convert(job);
 }
 
 //////////////////////////////////////////////////////////////////////////////
-// main                                                                     //
+// ParseArgs                                                                //
 //////////////////////////////////////////////////////////////////////////////
-int main(int argc, char *argv[])
+void ParseArgs(Job *job, int argc, char *argv[])
 {
-        // parse parameters
         for (int a=1; a<argc; a++)
         {
                 if (argv[a][0] == '-')
                 {
                         for (int i=1; argv[a][i]; i++)
                         {
-                                flags[argv[a][i]]++;
-                                if ((argv[a][i] >= '0') && (argv[a][i] <= '9')) paletteFile = argv[++a];
+                                job->flags[argv[a][i]]++;
+                                // parameter follows: done with this argument
+                                if ((argv[a][i] >= '0') && (argv[a][i] <= '9')) { job->paletteFile = argv[++a]; break; }
+                                if ((argv[a][i] == 'j') && (a+1 < argc)) { job->threads = atoi(argv[++a]); break; }
+                                if ((argv[a][i] == 'b') && (a+1 < argc)) { job->manifestFile = argv[++a]; break; }
+                                if ((argv[a][i] == 'k') && (a+1 < argc)) { job->mapFile = argv[++a]; break; }
+                                if ((argv[a][i] == 's') && (a+1 < argc)) { job->sliceSpec = argv[++a]; break; }
+                                if ((argv[a][i] == 'o') && (a+1 < argc)) { job->paletteFormat = argv[++a][0]; break; }
+                                if ((argv[a][i] == 'D') && (a+1 < argc)) { job->dither = argv[++a][0]; break; }
                         }
                 }
                 else
                 {
-                        if (!inputFile) inputFile = argv[a];
-                        else if (!outputFile) outputFile = argv[a];
-                        else if (!outPaletteFile) outPaletteFile = argv[a];
+                        if (!job->inputFile) job->inputFile = argv[a];
+                        else if (!job->outputFile) job->outputFile = argv[a];
+                        else if (!job->outPaletteFile) job->outPaletteFile = argv[a];
                         else
                         {
-                                fprintf(stderr, "Error: Too many filenames given!\n");
+                                gt_printf(job->log, "Error: Too many filenames given!\n");
                         }
                 }
         }
+}
 
-        // show help
-        if (flags['?'] || flags['h'] || !inputFile || !outputFile)
+//////////////////////////////////////////////////////////////////////////////
+// RunBatch                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+int RunBatch(const Job *defaults)
+{
+        gt_stats_phase(defaults->stats, GT_OPEN);
+        FILE *f = fopen(defaults->manifestFile, "r");
+        if (!f) { gt_printf(defaults->log, "Error opening manifest file!\n"); return -1; }
+        if (defaults->stats) defaults->stats->opens++;
+
+        // one job per line, each line holds the usual [-flags] <input.bmp> <output.raw> [<palette.txt>]
+        std::vector<Job *> jobs;
+        char line[4096];
+        int lineNumber = 0;
+        int errors = 0;
+        while (fgets(line, sizeof(line), f))
         {
-                fprintf(stderr, "bmp2bin " VER "\n");
-                fprintf(stderr, "\n");
-                fprintf(stderr, "Syntax: bmp2bin [-flags] <input.bmp> <output.raw> [<palette.txt>]\n");
-                fprintf(stderr, "\n");
-                fprintf(stderr, "Flags/parameters:\n");
-                fprintf(stderr, "  -i                  8 bits output, LUT, GP32 256 colors palette\n");
-                fprintf(stderr, "  -e                  8 bits output, b2g3r3)\n");
-                fprintf(stderr, "  -1 palette.act      8 bits output, palette quantization method 1\n");
-                fprintf(stderr, "  -g                  16 bits output, x1b5g5r5, GameBoy\n");
-                fprintf(stderr, "  -d                  16 bits output, x1b5g5r5, DS, x bit set\n");
-                fprintf(stderr, "  -p                  16 bits output, r5g5b5x1, GP32 (default)\n");
-                fprintf(stderr, "  -q                  16 bits output, r5g6b5, GP2X\n");
-                fprintf(stderr, "  -t                  24 bits output, b8g8r8\n");
-                fprintf(stderr, "  -r                  rotate 90 degrees clockwise\n");
-                fprintf(stderr, "  -x                  write sprite header, Mr.Mirko SDK\n");
-                return -1;
-        }
+                lineNumber++;
 
-        // read palette
-        if (paletteFile)
-        {
-                // open bitmap file
-                FILE *f = fopen(paletteFile, "rb");
-                if (!f) { fprintf(stderr, "Error opening palette file!\n"); return -1; }
-                
-                fseek(f, 0, SEEK_END);
-                int size = ftell(f);
-                fseek(f, 0, SEEK_SET);
-        
-                // read data
-                //if (strstr(paletteFile, ".act"))
-                if (size == 3*256)
-                {
-                        // assume r,g,b...
-                        unsigned char paletteData[256][3];
-                        fread(paletteData, sizeof(paletteData), 1, f);
+                Job *job = new Job(*defaults);
+                job->inputFile = job->outputFile = job->outPaletteFile = job->manifestFile = job->mapFile = NULL;
+                job->threads = 1;
 
-                        for (int i=0; i<256; i++)
-                        {
-                                palette[i].rgbtRed = paletteData[i][0];
-                                palette[i].rgbtGreen = paletteData[i][1];
-                                palette[i].rgbtBlue = paletteData[i][2];
-                        }
-                }
-                else if (size == 4*256)
+                // split by hand, strtok is not safe with several batches running in a server
+                for (char *token = line + strspn(line, " \t\r\n"); *token; token += strspn(token, " \t\r\n"))
                 {
-                        // assume r,g,b,x...
-                        unsigned char paletteData[256][4];
-                        fread(paletteData, sizeof(paletteData), 1, f);
-
-                        for (int i=0; i<256; i++)
-                        {
-                                palette[i].rgbtRed = paletteData[i][0];
-                                palette[i].rgbtGreen = paletteData[i][1];
-                                palette[i].rgbtBlue = paletteData[i][2];
-                        }
+                        if (token[0] == '#') break;
+                        size_t length = strcspn(token, " \t\r\n");
+                        job->args.push_back(std::string(token, length));
+                        token += length;
                 }
-                else
+                if (job->args.empty()) { delete job; continue; }
+
+                std::vector<char *> argv(1, (char *)"bmp2bin");
+                for (size_t i=0; i<job->args.size(); i++) argv.push_back(&job->args[i][0]);
+                ParseArgs(job, argv.size(), &argv[0]);
+
+                if (!job->inputFile || !job->outputFile)
                 {
-                        fprintf(stderr, "Unknown palette format!\n");
-                        return -1;
+                        gt_printf(defaults->log, "Error: %s:%d: missing file names!\n", defaults->manifestFile, lineNumber);
+                        errors++;
+                        delete job;
+                        continue;
                 }
-                
-                // close file
-                fclose(f);
+                jobs.push_back(job);
         }
+        fclose(f);
+        gt_stats_phase(defaults->stats, -1);
 
-        // outpalette
+        // jobs run on the worker threads, each job converts single threaded unless it asks otherwise
+        int threads = defaults->threads;
+        if (threads <= 0) threads = MAX(1, (int)std::thread::hardware_concurrency());
+        threads = MIN(threads, (int)jobs.size());
 
-        if (outPaletteFile && (flags['i'])) {
-                if ((fp = fopen(outPaletteFile,"wb")) == NULL) {
-                        fprintf(stderr,"Error opening output palette file!\n");
-                        return -1;      // let the compiler do the cleanup :/
-                }
+        // each job keeps its own stats, the phases of jobs run side by side add up
+        std::vector<gt_stats> stats(defaults->stats ? jobs.size() : 0);
+        for (size_t i=0; i<stats.size(); i++)
+        {
+                gt_stats_init(&stats[i]);
+                jobs[i]->stats = &stats[i];
         }
 
-        // read
+        // each job logs into its own buffer, a shared sink may not take writes from several threads;
+        // the logs are passed on in manifest order once every job is done
+        std::vector<gt_buffer> logs(jobs.size());
+        std::vector<gt_sink> logSinks(jobs.size());
+        for (size_t i=0; i<jobs.size(); i++)
         {
-                // open bitmap file
-                fi = fopen(inputFile, "rb");
-                if (!fi) { fprintf(stderr, "Error opening bitmap file!\n"); return -1; }
-
-                // read headers
-                fread(&bfh, sizeof(bfh), 1, fi);
-                fread(&bih, sizeof(bih), 1, fi);
-
-                // checks
-                if (endiaW(bih.biPlanes) != 1) { fprintf(stderr, "Unsupported number of planes!\n"); return -1; }
-                if (endiaDW(bih.biCompression) != 0) { fprintf(stderr, "Unsupported compression type!\n"); return -1; }
-
-                // load to RGB format
-                imageData = new RGBTRIPLE[endiaL(bih.biWidth) * endiaL(bih.biHeight) + 1/*dummy*/];
+                memset(&logs[i], 0, sizeof(logs[i]));
+                gt_buffer_sink(&logSinks[i], &logs[i]);
+                jobs[i]->log = &logSinks[i];
+        }
 
-                // load data with correct bit depth
-                if (endiaW(bih.biBitCount) == 8)
+        std::atomic<int> next(0);
+        std::atomic<int> failed(0);
+        std::vector<std::thread> pool;
+        for (int t=0; t<MAX(threads, 1); t++)
+        {
+                pool.push_back(std::thread([&]()
                 {
-                        fprintf(stderr,"  The BMP is a 8bits image..\n");
-                        // read palette (quads -> triples)
-                        RGBQUAD paletteQ[256];
-                        RGBTRIPLE palette[256];
-                        fread(paletteQ, sizeof(paletteQ), 1, fi);
-                        for (int i=0; i<256; i++)
+                        for (int i; (i = next++) < (int)jobs.size(); )
                         {
-                                palette[i].rgbtRed = paletteQ[i].rgbRed;
-                                palette[i].rgbtGreen = paletteQ[i].rgbGreen;
-                                palette[i].rgbtBlue = paletteQ[i].rgbBlue;
-                        }
-                        
-                        if (fp && flags['i']) {
-                                writePaletteGP(paletteQ,0,fp);
+                                if (ConvertFile(jobs[i]) != 0)
+                                {
+                                        gt_printf(jobs[i]->log, "Error converting %s!\n", jobs[i]->inputFile);
+                                        failed++;
+                                }
                         }
+                }));
+        }
+        for (size_t t=0; t<pool.size(); t++) pool[t].join();
 
+        for (size_t i=0; i<logs.size(); i++)
+        {
+                if (defaults->log && logs[i].size) defaults->log->write(defaults->log->context, logs[i].data, logs[i].size);
+                gt_buffer_free(&logs[i]);
+        }
 
-                        // go to pixel data
-                        fseek(fi, endiaDW(bfh.bfOffBits), SEEK_SET);
-                        
-                        int lineSize = endiaL(bih.biWidth) * 1;
-                        int dummysize = ALIGN4(lineSize) - lineSize;
-                        int dummy;
-                        
-                        unsigned char *lineData = new unsigned char [lineSize];
-        
-                        // read & convert pixel data
-                        for (int y=endiaL(bih.biHeight)-1; y>=0; y--)
-                        {
-                                RGBTRIPLE *pImageData = imageData + (endiaL(bih.biWidth)*y);            // imageData is up-side down!
-                                fread(lineData, lineSize, 1, fi);
-                                fread(&dummy, dummysize, 1, fi);
-                                if (flags['i']) {
-                                        for (int x=0; x<endiaL(bih.biWidth); x++) pImageData[x].rgbtRed = lineData[x];
-                                } else {
-                                        for (int x=0; x<endiaL(bih.biWidth); x++) pImageData[x] = palette[lineData[x]];
-                                }
-                        }
-                }
-                else if (endiaW(bih.biBitCount) == 24)
-                {
-                        fprintf(stderr,"  The BMP is a 24bits image..\n");
-                        // go to pixel data
-                        fseek(fi, endiaDW(bfh.bfOffBits), SEEK_SET);
-
-                        int lineSize = endiaL(bih.biWidth) * 3;
-                        int dummysize = ALIGN4(lineSize) - lineSize;
-                        int dummy;
-        
-                        // read pixel data
-                        for (int y=endiaL(bih.biHeight)-1; y>=0; y--)
-                        {
-                                RGBTRIPLE *pImageData = imageData + endiaL(bih.biWidth)*y;              // imageData is up-side down!
-                                fread(pImageData, lineSize, 1, fi);
-                                fread(&dummy, dummysize, 1, fi);
-                        }
-                }
-                else
-                {
-                        fprintf(stderr, "Unsupported bit depth!\n");
-                        return -1;
-                }
-        
-                // close file
-                fclose(fi);
+        for (size_t i=0; i<stats.size(); i++)
+        {
+                gt_stats_phase(&stats[i], -1);
+                gt_stats_add(defaults->stats, &stats[i]);
         }
+        for (size_t i=0; i<jobs.size(); i++) delete jobs[i];
 
-        // Close output palette file..
-        if (fp) fclose(fp);
+        return (errors || failed) ? -1 : 0;
+}
 
-        // select pixel writer
-        writePixel = WritePixelGP32;
-        if (flags['p']) writePixel = WritePixelGP32;
-	if (flags['q']) writePixel = WritePixelGP2X;
-        if (flags['g'] || flags['d'] ) writePixel = WritePixelGB;
-        if (flags['i']) writePixel = WritePixelGP8;
-        if (flags['e']) writePixel = WritePixel8;
-        if (flags['t']) writePixel = WritePixel24;
-        if (flags['1']) writePixel = WritePixelP1;
+//////////////////////////////////////////////////////////////////////////////
+// ShowHelp                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+void ShowHelp(const gt_sink *log)
+{
+        gt_printf(log, "bmp2bin " VER "\n");
+        gt_printf(log, "\n");
+        gt_printf(log, "Syntax: bmp2bin [-flags] <input.bmp> <output.raw> [<palette.txt>]\n");
+        gt_printf(log, "        bmp2bin [-flags] -b <manifest.txt>\n");
+        gt_printf(log, "        bmp2bin --serve [socket]\n");
+        gt_printf(log, "\n");
+        gt_printf(log, "Flags/parameters:\n");
+        gt_printf(log, "  -i                  8 bits output, LUT, GP32 256 colors palette\n");
+        gt_printf(log, "  -n                  4 bits output, LUT, 16 colors\n");
+        gt_printf(log, "  -e                  8 bits output, b2g3r3)\n");
+        gt_printf(log, "  -1 palette.act      8 bits output, palette quantization method 1\n");
+        gt_printf(log, "                      (.act/raw 16 or 256 colors, JASC-PAL or GIMP .gpl)\n");
+        gt_printf(log, "  -g                  16 bits output, x1b5g5r5, GameBoy, x bit set if opaque\n");
+        gt_printf(log, "  -d                  16 bits output, x1b5g5r5, DS, x bit set if opaque,\n");
+        gt_printf(log, "                      always without alpha in the bitmap\n");
+        gt_printf(log, "  -p                  16 bits output, r5g5b5x1, GP32 (default)\n");
+        gt_printf(log, "  -q                  16 bits output, r5g6b5, GP2X\n");
+        gt_printf(log, "  -t                  24 bits output, b8g8r8\n");
+        gt_printf(log, "  -r                  rotate 90 degrees clockwise\n");
+        gt_printf(log, "  -l                  rotate 90 degrees counter-clockwise\n");
+        gt_printf(log, "  -u                  rotate 180 degrees\n");
+        gt_printf(log, "  -f                  flip horizontally\n");
+        gt_printf(log, "  -v                  flip vertically\n");
+        gt_printf(log, "  -x                  write sprite header, Mr.Mirko SDK\n");
+        gt_printf(log, "  -c                  tiled output, 8x8 tiles\n");
+        gt_printf(log, "  -C                  tiled output, 16x16 tiles\n");
+        gt_printf(log, "  -k map.bin          remove duplicate (also flipped) tiles and write\n");
+        gt_printf(log, "                      the tilemap, 16 bits per tile with flip bits\n");
+        gt_printf(log, "  -s WxH[,n[,pad]]    slice a spritesheet into n frames of WxH pixels,\n");
+        gt_printf(log, "  -s @rects.txt       or into the rectangles listed as \"x y w h\" lines;\n");
+        gt_printf(log, "                      an output name with %%d writes one file per frame,\n");
+        gt_printf(log, "                      otherwise frames follow a table of the frame count\n");
+        gt_printf(log, "                      and the offset of each frame (32 bits each)\n");
+        gt_printf(log, "  -o format           binary output palette, format is one of the output\n");
+        gt_printf(log, "                      flags p, q, g, d, t or e (default GP32 text); the\n");
+        gt_printf(log, "                      palette is written with -i, -n (16 colors) and -1\n");
+        gt_printf(log, "  -D b                ordered dithering (8x8 Bayer) instead of truncating\n");
+        gt_printf(log, "                      to the output format, for -p, -q, -g, -d, -e and -1\n");
+        gt_printf(log, "  -D f                Floyd-Steinberg dithering, same formats\n");
+        gt_printf(log, "  output.s            write the pixels (or palette) as a bin2s style module\n");
+        gt_printf(log, "  output.c            write the pixels (or palette) as raw2c style .c and .h\n");
+        gt_printf(log, "                      files, symbols are named after the file\n");
+        gt_printf(log, "  -j threads          convert in parallel bands (0 = one per CPU)\n");
+        gt_printf(log, "  -b manifest.txt     convert every line of the manifest, each holding\n");
+        gt_printf(log, "                      [-flags] <input.bmp> <output.raw> [<palette.txt>];\n");
+        gt_printf(log, "                      other flags are defaults for every line, -j sets\n");
+        gt_printf(log, "                      the number of parallel jobs\n");
+        gt_printf(log, "  --serve [socket]    take command lines as JSON lines from stdin or a Unix\n");
+        gt_printf(log, "                      socket and convert them on a pool of threads\n");
+        gt_printf(log, "  --stats[=file]      time spent per phase, to stderr or appended to file\n");
+        gt_printf(log, "                      as a JSON line, also enabled by GT_STATS=file; with\n");
+        gt_printf(log, "                      -b the phases of the jobs are summed\n");
+}
 
-        // write
-        {
-                fo = fopen(outputFile, "wb");
-                if (!fo) { fprintf(stderr, "Error opening output file!\n"); return -1; }
-
-                // Mr.Mirko 2004
-                // write Header
-                /*
-                typedef struct {
-                  char magic[4];
-                  u16 size_x;
-                  u16 size_y;
-                  u16 reserved1;
-                  u16 reserved2;
-                } SHEADER; */
-
-                if (flags['x'])
-                {
-                  char sdk[]="Mr.M";
-                  short reserved=0;
-                  short x = endiaL(bih.biWidth);
-                  short y = endiaL(bih.biHeight);
-
-                  if (flags['r']) { printf ("Please dont rotate Sprite...\n"); }
-
-                  fprintf(stderr, "X: %d\n",x);
-                  fprintf(stderr, "Y: %d\n",y);
-                  fwrite(&sdk, 1, 4, fo); // 4 bytes
-                  fwrite(&x, 2, 1, fo);   // 1 short
-                  fwrite(&y, 2, 1, fo);   // 1 short
-                  fwrite(&reserved, 2, 1, fo);// 1 short
-                  fwrite(&reserved, 2, 1, fo);// 1 short
-                }
+//////////////////////////////////////////////////////////////////////////////
+// Tool                                                                     //
+//////////////////////////////////////////////////////////////////////////////
+static int ParseJob(int argc, char **argv, const gt_sink *log, void **result)
+{
+        Job *job = new Job();
+        job->threads = 1;
+        job->log = log;
+        *result = NULL;
 
-                // rotated?
-                if (flags['r'])
-                {
-                        for (int x=0; x<endiaL(bih.biWidth); x++)
-                        {
-                                for (int y=endiaL(bih.biHeight)-1; y>=0; y--)
-                                {
-                                        RGBTRIPLE *p = imageData + (y*endiaL(bih.biWidth)) + x;
-                                        writePixel(p);
-                                }
-                        }
-                }
-                else
-                {
-//                        RGBTRIPLE *p = imageData;
-                        for (int y=0; y<endiaL(bih.biHeight); y++)
-                        {
-                                for (int x=0; x<endiaL(bih.biWidth); x++)
-                                {
-                                        RGBTRIPLE *p = imageData + (y*endiaL(bih.biWidth)) + x;
-                                        writePixel(p);
-                                }
-                        }
-                }
+        // parse parameters
+        ParseArgs(job, argc, argv);
 
-                // close files
-                fclose(fo);
+        // show help
+        if (job->flags['?'] || job->flags['h'] || (!job->manifestFile && (!job->inputFile || !job->outputFile)))
+        {
+                ShowHelp(log);
+                delete job;
+                return -1;
         }
 
+        *result = job;
         return 0;
 }
 
+static int JobOutputs(void *result, const char **names, int max)
+{
+        Job *job = (Job *)result;
+        int count = 0;
+
+        if (job->outputFile && count < max) names[count++] = job->outputFile;
+        if (job->outPaletteFile && count < max) names[count++] = job->outPaletteFile;
+        if (job->mapFile && count < max) names[count++] = job->mapFile;
+        return count;
+}
+
+static int RunJob(void *result, const gt_sink *out, const gt_sink *log, gt_stats *stats)
+{
+        Job *job = (Job *)result;
+        job->log = log;
+        job->stats = stats;
+
+        int status = job->manifestFile ? RunBatch(job) : ConvertFile(job);
+        delete job;
+        return status;
+}
+
+static const gt_tool tool = { "bmp2bin", ParseJob, JobOutputs, RunJob };
+
+//////////////////////////////////////////////////////////////////////////////
+// main                                                                     //
+//////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+        if ((argc > 1) && !strcmp(argv[1], "--serve")) return gt_serve(&tool, (argc > 2) ? argv[2] : NULL, 0);
+
+        const char *statsTo = gt_stats_option(&argc, argv);
+        gt_stats stats;
+        gt_stats_init(&stats);
+
+        gt_sink out, log;
+        gt_file_sink(&out, stdout);
+        gt_file_sink(&log, stderr);
+
+        void *job;
+        int status = ParseJob(argc, argv, &log, &job);
+        if (!job) return status;
+
+        status = RunJob(job, &out, &log, statsTo ? &stats : NULL);
+        gt_stats_report(&stats, "bmp2bin", statsTo);
+        return status;
+}
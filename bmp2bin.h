@@ -0,0 +1,176 @@
+//////////////////////////////////////////////////////////////////////////////
+// bmp2bin.h                                                                //
+//////////////////////////////////////////////////////////////////////////////
+/*
+        Bitmap to binary converter, shared by the bmp2bin tool and libgeneraltools
+*/
+#ifndef _bmp2bin_h_
+#define _bmp2bin_h_
+
+//////////////////////////////////////////////////////////////////////////////
+// Includes                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <string>
+#include <vector>
+#include "generaltools.h"
+//////////////////////////////////////////////////////////////////////////////
+// Defines                                                                  //
+//////////////////////////////////////////////////////////////////////////////
+#define ALIGN4(n)                       (((n)+3) &~ 3)
+#define ROWBYTES(n, bits)               (((long)(n)*(bits)+7) / 8)
+#define BLOCKSIZE                       16              // transform block size (pixels)
+#define BANDSIZE                        16              // minimum rows per parallel band
+#define MAXTILES                        1024            // tiles addressable by a tilemap entry
+#define SPRITEHEADERSIZE                12              // Mr.Mirko sprite header
+#define DITHERSPREAD                    32              // ordered dither amplitude for palette output
+#define DITHERUNIT                      (255*64)        // ordered dither fixed point: 8 bit values, 64 thresholds
+#define RLEEXPANSION                    256             // pixels an RLE bitmap may decode to per byte of data, runs give 127
+#define RLEMINPIXELS                    (4096*4096)     // RLE bitmaps up to this size are taken whatever their data size
+
+// compression types
+#define BI_RGB                          0
+#define BI_RLE8                         1
+#define BI_RLE4                         2
+#define BI_BITFIELDS                    3
+#define BI_ALPHABITFIELDS               6
+
+// 16 and 32 bit pixel layouts
+#define INPUT_BITFIELDS                 0               // any masks
+#define INPUT_BGRA8888                  1
+#define INPUT_BGRX8888                  2
+#define INPUT_RGB565                    3
+#define INPUT_ARGB1555                  4
+#define INPUT_XRGB1555                  5
+
+// tilemap entry bits
+#define TILE_HFLIP                      0x0400
+#define TILE_VFLIP                      0x0800
+
+// transform modes
+#define XFORM_ROTATE_MASK               3               // number of 90 degree clockwise turns
+#define XFORM_FLIPX                     4               // mirror horizontally (before rotating)
+#define XFORM_FLIPY                     8               // flip vertically (before rotating)
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Typedefs                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+typedef int LONG;
+
+#pragma pack(1)
+
+typedef struct tagRGBTRIPLE {
+        BYTE    rgbtBlue;
+        BYTE    rgbtGreen;
+        BYTE    rgbtRed;
+} RGBTRIPLE;
+
+typedef struct tagRGBQUAD {              // decoded pixels keep their alpha in rgbReserved
+        BYTE    rgbBlue;
+        BYTE    rgbGreen;
+        BYTE    rgbRed;
+        BYTE    rgbReserved;
+} RGBQUAD;
+
+typedef struct tagBITMAPFILEHEADER {    // size 14 bytes
+        WORD    bfType;
+        DWORD   bfSize;
+        WORD    bfReserved1;
+        WORD    bfReserved2;
+        DWORD   bfOffBits;
+} BITMAPFILEHEADER;
+
+typedef struct tagBITMAPINFOHEADER{             // size 40 bytes
+        DWORD      biSize;
+        LONG       biWidth;
+        LONG       biHeight;
+        WORD       biPlanes;
+        WORD       biBitCount;
+        DWORD      biCompression;
+        DWORD      biSizeImage;
+        LONG       biXPelsPerMeter;
+        LONG       biYPelsPerMeter;
+        DWORD      biClrUsed;
+        DWORD      biClrImportant;
+} BITMAPINFOHEADER;
+
+#pragma pack()
+
+struct Job;
+typedef BYTE *WritePixel(const Job *job, const RGBQUAD *p, BYTE *out);    // returns next output position
+
+typedef struct {                        // bitmap row reader, one per band
+        FILE    *f;
+        long    pos;                    // current file position
+        BYTE    *lineData;              // raw row buffer
+        BYTE    *indexLine;             // unpacked palette indices
+} RowReader;
+
+typedef struct {                        // spritesheet frame
+        int     x;
+        int     y;
+        int     width;
+        int     height;
+} Frame;
+
+typedef struct {                        // loaded palette file
+        RGBQUAD colors[256];
+        int     count;                  // colors given by the file, the rest is black
+} Palette;
+
+struct Job {                            // state of one conversion
+        char    *inputFile;
+        const BYTE *inputData;          // bitmap in memory instead of inputFile
+        long    inputSize;
+        char    *outputFile;
+        char    *paletteFile;
+        char    *outPaletteFile;
+        char    *manifestFile;
+        char    *mapFile;               // tilemap output, enables tile deduplication
+        const gt_sink *outputSink;      // outputs to sinks instead of the named files
+        const gt_sink *paletteSink;
+        const gt_sink *mapSink;         // also enables tile deduplication
+        const gt_sink *log;             // messages, none if NULL
+        gt_stats *stats;                // phase times and I/O counts, none if NULL
+        char    *sliceSpec;             // spritesheet frames: WxH[,count[,padding]] or @rects.txt
+        char    flags[256];
+        int     threads;                // worker threads
+        const Palette *palette;         // quantization palette, loaded by the caller and shared between jobs
+        int     paletteFormat;          // pixel format flag of binary palette output, 0 = GP32 text
+        int     dither;                 // 'b' ordered (Bayer), 'f' error diffusion (Floyd-Steinberg), 0 = none
+        int     ditherBits[3];          // red, green and blue bits kept by the pixel writer, 0 = palette
+        RGBQUAD bmpPalette[256];        // palette of an 8 bit bitmap
+        int     inputFormat;            // layout of 16 and 32 bit pixels
+        DWORD   masks[4];               // red, green, blue and alpha bit fields
+        int     alpha;                  // the bitmap has an alpha channel
+        int     maskShift[4];
+        int     maskBits[4];
+        BITMAPFILEHEADER bfh;
+        BITMAPINFOHEADER bih;
+        int     width;
+        int     height;
+        int     topDown;                // negative biHeight: rows stored top row first
+        int     lineSize;               // bytes per stored row, including padding
+        long    dataSize;               // bytes of pixel data in the file, checked by ReadHeaders
+        long    pixelCount;             // width * height, what a decoded image buffer holds, checked by ReadHeaders
+        BYTE    *indexData;             // decoded RLE bitmap, one palette index per pixel
+        WritePixel *writePixel;         // pixel write function
+        int     pixelBits;              // bits written per pixel
+        std::vector<std::string> args;  // argument storage for manifest jobs
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Functions                                                                //
+//////////////////////////////////////////////////////////////////////////////
+bool ParsePalette(const BYTE *data, long size, Palette *palette);
+int Convert(Job *job);
+
+#endif // _bmp2bin_h_
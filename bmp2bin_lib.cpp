@@ -0,0 +1,1768 @@
+//////////////////////////////////////////////////////////////////////////////
+// bmp2bin_lib.cpp                                                          //
+//////////////////////////////////////////////////////////////////////////////
+/*
+        Bitmap to binary converter, decoding and conversion
+        by Rafael Vuijk (aka Dark Fader)
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+// Includes                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+#include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include "bmp2bin.h"
+#include "binformat.h"
+
+//
+// Convert Little Endian to Big Endian..
+//
+
+/*static BYTE endiaB( BYTE b ) {
+        return b;
+}
+*/
+static WORD endiaW( WORD w ) {
+#if BYTE_ORDER == BIG_ENDIAN
+        WORD rw;
+        rw = ((w >> 8) | (w << 8));
+        //printf("%04x -> %04x\n",w,rw);
+        return rw;
+#elif BYTE_ORDER == LITTLE_ENDIAN
+        return w;
+#else
+#error unknown endianess..
+#endif
+
+}
+
+static DWORD endiaDW( DWORD w ) {
+#if BYTE_ORDER == BIG_ENDIAN
+        DWORD rw;
+        WORD wu = w >> 16;
+        WORD wl = w & 0xffff;
+        wu = (wu >> 8) | (wu << 8);
+        wl = (wl >> 8) | (wl << 8);
+        rw = ((wl << 16) | (wu));
+        //printf("%08x -> %08x\n",w,rw);
+        return rw;
+#elif BYTE_ORDER == LITTLE_ENDIAN
+        return w;
+#else
+#error unknown endianess..
+#endif
+}
+
+static LONG endiaL( LONG w ) {
+#if BYTE_ORDER == BIG_ENDIAN
+        LONG rw;
+        WORD wu = (WORD)(w >> 16);
+        WORD wl = (WORD)(w & 0xffff);
+        wu = (wu >> 8) | (wu << 8);
+        wl = (wl >> 8) | (wl << 8);
+        rw = ((wl << 16) | (wu));
+        //printf("%08x -> %08x\n",w,rw);
+        return rw;
+#elif BYTE_ORDER == LITTLE_ENDIAN
+        return w;
+#else
+#error unknown endianess..
+#endif
+}
+
+//
+//
+//
+
+struct UnpackTables {                   // palette indices of every 1 and 4 bit pixel byte
+        BYTE    bits[256][8];
+        BYTE    nibbles[256][2];
+
+        UnpackTables()
+        {
+                for (int b=0; b<256; b++)
+                {
+                        for (int i=0; i<8; i++) bits[b][i] = (b >> (7-i)) & 1;
+                        nibbles[b][0] = b >> 4;
+                        nibbles[b][1] = b & 15;
+                }
+        }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Variables                                                                //
+//////////////////////////////////////////////////////////////////////////////
+static const UnpackTables unpack;
+
+//
+//
+//
+
+//////////////////////////////////////////////////////////////////////////////
+// Report                                                                   //
+//////////////////////////////////////////////////////////////////////////////
+void Report(const Job *job, const char *format, ...)
+{                                               // messages go to the job's log sink, if any
+        if (!job->log) return;
+
+        char text[1024];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+
+        if (len > 0) job->log->write(job->log->context, text, MIN(len, (int)sizeof(text)-1));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Count                                                                    //
+//////////////////////////////////////////////////////////////////////////////
+inline void Count(unsigned long *counter, unsigned long n)
+{                                               // stats counts, bands update them from several threads
+        __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+inline void Count(unsigned long long *counter, unsigned long long n)
+{
+        __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static int writePaletteGP( const RGBQUAD* p, int count, char *text ) {      // returns the text length
+        static const char hex[] = "0123456789abcdef";
+        char *t = text;
+        int m,n;
+        RGBQUAD q;
+
+        // formatted into one buffer, 16 entries per line
+        for (n = 0; n < count; n += 16 ) {
+                for (m = 0; m < 16 && n+m < count; m++) {
+                        q = p[n+m];
+                        unsigned int w = (q.rgbBlue>>3<<1) | (q.rgbGreen>>3<<6) | (q.rgbRed>>3<<11);
+
+                        *t++ = '0'; *t++ = 'x';
+                        *t++ = hex[w >> 12]; *t++ = hex[(w >> 8) & 15]; *t++ = hex[(w >> 4) & 15]; *t++ = hex[w & 15];
+                        *t++ = (m < 15) ? ',' : '\n';
+                }
+        }
+        return t - text;
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Sqr                                                                      //
+//////////////////////////////////////////////////////////////////////////////
+inline unsigned long Sqr(unsigned int n)
+{
+        return n*n;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Dist1                                                                    //
+//////////////////////////////////////////////////////////////////////////////
+unsigned long Dist1(const RGBQUAD *a, const RGBQUAD *b)
+{
+        return
+        (
+                Sqr((int)a->rgbRed - (int)b->rgbRed)*28 +
+                Sqr((int)a->rgbGreen - (int)b->rgbGreen)*91 +
+                Sqr((int)a->rgbBlue - (int)b->rgbBlue)*9
+        );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// NearestColor                                                             //
+//////////////////////////////////////////////////////////////////////////////
+int NearestColor(const Palette *palette, const RGBQUAD *p)
+{
+        int out = 0;
+        unsigned long bestDist = (unsigned long)-1;
+        
+        for (int i=0; i<palette->count; i++)
+        {
+                unsigned long dist = Dist1(p, &palette->colors[i]);
+                if (dist < bestDist) { bestDist = dist; out = i; }
+        }
+        
+        return out;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WritePixelP1                                                             //
+//////////////////////////////////////////////////////////////////////////////
+BYTE *WritePixelP1(const Job *job, const RGBQUAD *p, BYTE *o)         // '1': 8 bits palette (method 1)
+{
+        *o++ = NearestColor(job->palette, p);
+        return o;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WritePixel24                                                             //
+//////////////////////////////////////////////////////////////////////////////
+BYTE *WritePixel24(const Job *job, const RGBQUAD *p, BYTE *o) // 't': 24 bits
+{
+        *o++ = p->rgbRed;
+        *o++ = p->rgbGreen;
+        *o++ = p->rgbBlue;
+        return o;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WritePixel8                                                              //
+//////////////////////////////////////////////////////////////////////////////
+BYTE *WritePixel8(const Job *job, const RGBQUAD *p, BYTE *o)          // 'e': 8 bits (b2g3r3)
+{
+        *o++ = (p->rgbBlue>>6<<6) | (p->rgbGreen>>5<<3) | (p->rgbRed>>5<<0);
+        return o;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WritePixelGP8                                                            //
+//////////////////////////////////////////////////////////////////////////////
+BYTE *WritePixelGP8(const Job *job, const RGBQUAD *p, BYTE *o)        // 'i': 8 bits (LUT, GamePark)
+{
+        *o++ = p->rgbRed;
+ // hack by Mr.Spiv
+        return o;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WritePixelGP32                                                           //
+//////////////////////////////////////////////////////////////////////////////
+BYTE *WritePixelGP32(const Job *job, const RGBQUAD *p, BYTE *o)       // 'p': 16 bits (r5g5b5x1, GamePark)
+{
+        unsigned short out = endiaW((p->rgbBlue>>3<<1) | (p->rgbGreen>>3<<6) | (p->rgbRed>>3<<11));
+        memcpy(o, &out, 2);
+        return o + 2;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WritePixelGP2X                                                           //
+//////////////////////////////////////////////////////////////////////////////
+BYTE *WritePixelGP2X(const Job *job, const RGBQUAD *p, BYTE *o)       // '2': 16 bits (r5g6b5, GP2X)
+{
+        unsigned short out = endiaW((p->rgbBlue>>3) | ((p->rgbGreen&0xFC) << 3) | ((p->rgbRed&0xF8)<<8));
+        memcpy(o, &out, 2);
+        return o + 2;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WritePixelGB                                                             //
+//////////////////////////////////////////////////////////////////////////////
+BYTE *WritePixelGB(const Job *job, const RGBQUAD *p, BYTE *o)         // 'g': 16 bits (x1b5g5r5, GameBoy)
+{
+        unsigned short out = (p->rgbBlue>>3<<10) | (p->rgbGreen>>3<<5) | (p->rgbRed>>3<<0);
+        // x bit: opaque pixels of a bitmap with alpha, with -d every pixel of one without
+        if (job->alpha ? (p->rgbReserved & 0x80) : job->flags['d']) out |= 0x8000;
+        memcpy(o, &out, 2);
+        return o + 2;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ConvertRow                                                               //
+//////////////////////////////////////////////////////////////////////////////
+BYTE *ConvertRow(const Job *job, const RGBQUAD *p, int count, BYTE *out)
+{
+        if (job->pixelBits == 4)                // 'n': 4 bits (LUT), first pixel in the low nibble
+        {
+                for (int x=0; x<count; x+=2)
+                {
+                        BYTE hi = (x+1 < count) ? p[x+1].rgbRed & 15 : 0;
+                        *out++ = (p[x].rgbRed & 15) | (hi << 4);
+                }
+                return out;
+        }
+
+        WritePixel *writePixel = job->writePixel;
+        for (int x=0; x<count; x++) out = writePixel(job, p++, out);
+        return out;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// OpenReader                                                               //
+//////////////////////////////////////////////////////////////////////////////
+bool OpenReader(const Job *job, RowReader *r)
+{                                               // rows of a decoded RLE bitmap or a bitmap in memory need no file
+        r->f = (job->indexData || job->inputData) ? NULL : fopen(job->inputFile, "rb");
+        if (r->f && job->stats) Count(&job->stats->opens, 1);
+        r->pos = -1;
+        r->lineData = new BYTE[job->lineSize];
+        r->indexLine = new BYTE[job->width + 8/*unpack slack*/];
+        return job->indexData || job->inputData || r->f;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ReadAt                                                                   //
+//////////////////////////////////////////////////////////////////////////////
+long ReadAt(const Job *job, RowReader *r, long pos, void *data, long size)
+{                                               // returns the bytes read, the rest of data is cleared
+        long got = 0;
+
+        if (job->inputData)
+        {
+                if ((pos >= 0) && (pos < job->inputSize)) got = MIN(size, job->inputSize - pos);
+                if (got) memcpy(data, job->inputData + pos, got);
+        }
+        else
+        {
+                // sequential reads don't seek
+                if (pos != r->pos) fseek(r->f, pos, SEEK_SET);
+                got = fread(data, 1, size, r->f);
+
+                if (job->stats)
+                {
+                        if (pos != r->pos) Count(&job->stats->seeks, 1);
+                        Count(&job->stats->reads, 1);
+                        Count(&job->stats->bytesIn, got);
+                }
+        }
+
+        r->pos = pos + got;
+        if (got < size) memset((BYTE *)data + got, 0, size - got);
+        return got;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// InputSize                                                                //
+//////////////////////////////////////////////////////////////////////////////
+long InputSize(const Job *job, RowReader *r)
+{
+        if (job->inputData) return job->inputSize;
+
+        if (job->stats) Count(&job->stats->seeks, 1);
+        fseek(r->f, 0, SEEK_END);
+        r->pos = -1;
+        return ftell(r->f);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CloseReader                                                              //
+//////////////////////////////////////////////////////////////////////////////
+void CloseReader(RowReader *r)
+{
+        if (r->f) fclose(r->f);
+        delete[] r->lineData;
+        delete[] r->indexLine;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Expand                                                                   //
+//////////////////////////////////////////////////////////////////////////////
+inline BYTE Expand(DWORD value, int bits)       // scales a bits wide channel to 8 bits
+{
+        if (bits >= 8) return value >> (bits-8);
+        if (bits <= 0) return 0xFF;
+        return (value * 255 + ((1 << bits) - 1) / 2) / ((1 << bits) - 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// DecodeDirect                                                             //
+//////////////////////////////////////////////////////////////////////////////
+void DecodeDirect(const Job *job, const BYTE *s, int width, RGBQUAD *row)
+{                                               // 16 and 32 bit pixels
+        switch (job->inputFormat)
+        {
+                case INPUT_BGRA8888:
+                        for (int x=0; x<width; x++, s+=4)
+                        {
+                                row[x].rgbBlue = s[0]; row[x].rgbGreen = s[1]; row[x].rgbRed = s[2]; row[x].rgbReserved = s[3];
+                        }
+                        break;
+
+                case INPUT_BGRX8888:
+                        for (int x=0; x<width; x++, s+=4)
+                        {
+                                row[x].rgbBlue = s[0]; row[x].rgbGreen = s[1]; row[x].rgbRed = s[2]; row[x].rgbReserved = 0xFF;
+                        }
+                        break;
+
+                case INPUT_RGB565:
+                        for (int x=0; x<width; x++, s+=2)
+                        {
+                                unsigned v = s[0] | (s[1] << 8);
+                                BYTE r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+                                row[x].rgbRed = (r << 3) | (r >> 2);
+                                row[x].rgbGreen = (g << 2) | (g >> 4);
+                                row[x].rgbBlue = (b << 3) | (b >> 2);
+                                row[x].rgbReserved = 0xFF;
+                        }
+                        break;
+
+                case INPUT_ARGB1555:
+                case INPUT_XRGB1555:
+                {
+                        int alpha = job->inputFormat == INPUT_ARGB1555;
+                        for (int x=0; x<width; x++, s+=2)
+                        {
+                                unsigned v = s[0] | (s[1] << 8);
+                                BYTE r = (v >> 10) & 31, g = (v >> 5) & 31, b = v & 31;
+                                row[x].rgbRed = (r << 3) | (r >> 2);
+                                row[x].rgbGreen = (g << 3) | (g >> 2);
+                                row[x].rgbBlue = (b << 3) | (b >> 2);
+                                row[x].rgbReserved = (!alpha || (v & 0x8000)) ? 0xFF : 0;
+                        }
+                        break;
+                }
+
+                default:
+                {
+                        int bytes = endiaW(job->bih.biBitCount) / 8;
+                        for (int x=0; x<width; x++, s+=bytes)
+                        {
+                                DWORD v = s[0] | (s[1] << 8);
+                                if (bytes == 4) v |= (s[2] << 16) | ((DWORD)s[3] << 24);
+                                row[x].rgbRed = Expand((v & job->masks[0]) >> job->maskShift[0], job->maskBits[0]);
+                                row[x].rgbGreen = Expand((v & job->masks[1]) >> job->maskShift[1], job->maskBits[1]);
+                                row[x].rgbBlue = Expand((v & job->masks[2]) >> job->maskShift[2], job->maskBits[2]);
+                                row[x].rgbReserved = Expand((v & job->masks[3]) >> job->maskShift[3], job->maskBits[3]);
+                        }
+                        break;
+                }
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ReadRow                                                                  //
+//////////////////////////////////////////////////////////////////////////////
+void ReadRow(const Job *job, RowReader *r, int y, RGBQUAD *row)      // y = 0 is the top row
+{
+        int width = job->width;
+        int bitCount = endiaW(job->bih.biBitCount);
+        const BYTE *indices;
+
+        if (job->indexData)
+        {
+                indices = job->indexData + (long)width*y;
+        }
+        else
+        {
+                int lineSize = job->lineSize;
+                int fileRow = job->topDown ? y : job->height-1-y;
+                long pos = endiaDW(job->bfh.bfOffBits) + (long)fileRow*lineSize;
+                BYTE *lineData = r->lineData;
+
+                // rows are requested in order, so only bottom-up files seek for every row;
+                // ReadHeaders made sure the file holds them, so the read isn't checked
+                ReadAt(job, r, pos, lineData, lineSize);
+
+                if (bitCount == 24)
+                {
+                        const BYTE *s = lineData;
+                        for (int x=0; x<width; x++, s+=3)
+                        {
+                                row[x].rgbBlue = s[0];
+                                row[x].rgbGreen = s[1];
+                                row[x].rgbRed = s[2];
+                                row[x].rgbReserved = 0xFF;
+                        }
+                        return;
+                }
+                if (bitCount >= 16)
+                {
+                        DecodeDirect(job, lineData, width, row);
+                        return;
+                }
+
+                indices = lineData;
+                if (bitCount == 4)
+                {
+                        for (int i=0; i<(width+1)/2; i++) memcpy(r->indexLine + 2*i, unpack.nibbles[lineData[i]], 2);
+                        indices = r->indexLine;
+                }
+                else if (bitCount == 1)
+                {
+                        for (int i=0; i<(width+7)/8; i++) memcpy(r->indexLine + 8*i, unpack.bits[lineData[i]], 8);
+                        indices = r->indexLine;
+                }
+        }
+
+        if (job->flags['i'] || job->flags['n']) {
+                for (int x=0; x<width; x++) row[x].rgbRed = indices[x];
+        } else {
+                for (int x=0; x<width; x++) row[x] = job->bmpPalette[indices[x]];
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// DecodeRLE                                                                //
+//////////////////////////////////////////////////////////////////////////////
+bool DecodeRLE(const Job *job, const BYTE *data, long size, BYTE *out)
+{                                               // out: one index per pixel, top row first
+        int width = job->width;
+        int height = job->height;
+        int rle4 = endiaDW(job->bih.biCompression) == BI_RLE4;
+        int x = 0;
+        int y = 0;                              // file row
+        long pos = 0;
+
+        while (pos+2 <= size)
+        {
+                int n = data[pos++];
+                int c = data[pos++];
+
+                if (n)
+                {
+                        // encoded run: n pixels of c (RLE4: alternating nibbles)
+                        if (y < height)
+                        {
+                                BYTE *d = out + (long)width*(job->topDown ? y : height-1-y);
+                                for (int i=0; i<n && x<width; i++, x++) d[x] = rle4 ? ((i & 1) ? c & 15 : c >> 4) : c;
+                        }
+                        continue;
+                }
+
+                switch (c)
+                {
+                        case 0:                 // end of line
+                                x = 0;
+                                y++;
+                                break;
+                        case 1:                 // end of bitmap
+                                return true;
+                        case 2:                 // delta
+                                if (pos+2 > size) return false;
+                                x += data[pos++];
+                                y += data[pos++];
+                                break;
+                        default:                // absolute run of c pixels, padded to a word
+                        {
+                                long bytes = rle4 ? (c+1)/2 : c;
+                                if (pos+bytes > size) return false;
+                                if (y < height)
+                                {
+                                        BYTE *d = out + (long)width*(job->topDown ? y : height-1-y);
+                                        for (int i=0; i<c && x+i<width; i++)
+                                        {
+                                                BYTE b = data[pos + (rle4 ? i/2 : i)];
+                                                d[x+i] = rle4 ? ((i & 1) ? b & 15 : b >> 4) : b;
+                                        }
+                                }
+                                x += c;
+                                pos += (bytes + 1) & ~1;
+                                break;
+                        }
+                }
+        }
+
+        return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MapPixel                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+long MapPixel(int x, int y, int width, int height, int mode)    // returns destination index
+{
+        int ox, oy, ow;
+
+        if (mode & XFORM_FLIPX) x = width-1-x;
+        if (mode & XFORM_FLIPY) y = height-1-y;
+
+        switch (mode & XFORM_ROTATE_MASK)
+        {
+                default:
+                case 0: ox = x;          oy = y;          ow = width;  break;
+                case 1: ox = height-1-y; oy = x;          ow = height; break;       // 90 clockwise
+                case 2: ox = width-1-x;  oy = height-1-y; ow = width;  break;       // 180
+                case 3: ox = y;          oy = width-1-x;  ow = height; break;       // 270 clockwise
+        }
+
+        return (long)oy*ow + ox;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Transform                                                                //
+//////////////////////////////////////////////////////////////////////////////
+void Transform(const RGBQUAD *src, RGBQUAD *dst, int width, int height, int mode, int x0, int x1)
+{                                               // transforms source columns x0..x1-1
+        // every mode is affine, so three mapped points give origin and steps
+        long origin = MapPixel(0, 0, width, height, mode);
+        long stepX = MapPixel(1, 0, width, height, mode) - origin;
+        long stepY = MapPixel(0, 1, width, height, mode) - origin;
+
+        // walk the source in blocks so the scattered writes stay within a few cache lines
+        for (int by=0; by<height; by+=BLOCKSIZE)
+        {
+                int ey = MIN(by+BLOCKSIZE, height);
+                for (int bx=x0; bx<x1; bx+=BLOCKSIZE)
+                {
+                        int ex = MIN(bx+BLOCKSIZE, x1);
+                        for (int y=by; y<ey; y++)
+                        {
+                                const RGBQUAD *s = src + (long)y*width;
+                                RGBQUAD *d = dst + origin + y*stepY;
+                                for (int x=bx; x<ex; x++) d[x*stepX] = s[x];
+                        }
+                }
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// DitherRow                                                                //
+//////////////////////////////////////////////////////////////////////////////
+static const BYTE bayer8[8][8] =
+{
+        {  0, 32,  8, 40,  2, 34, 10, 42 },
+        { 48, 16, 56, 24, 50, 18, 58, 26 },
+        { 12, 44,  4, 36, 14, 46,  6, 38 },
+        { 60, 28, 52, 20, 62, 30, 54, 22 },
+        {  3, 35, 11, 43,  1, 33,  9, 41 },
+        { 51, 19, 59, 27, 49, 17, 57, 25 },
+        { 15, 47,  7, 39, 13, 45,  5, 37 },
+        { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+inline BYTE DitherLevel(int v, int scale, int offset)
+{
+        v = (v * scale + offset) / DITHERUNIT;
+        return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+void DitherRow(const Job *job, RGBQUAD *row, int count, int y)
+{                                               // ordered dither in place, the writer's truncation then picks the level
+        // a channel of n+1 levels gets level (v*n + threshold*255/64) / 255, scaled back so the level is
+        // in the bits the writer keeps: v' = (v*scale + offset) / DITHERUNIT, for 8 pixels of b, g, r, a
+        int scale[32], offset[32];
+
+        for (int x=0; x<8; x++)
+        {
+                int t = bayer8[y & 7][x];
+                for (int c=0; c<3; c++)
+                {
+                        int bits = job->ditherBits[2-c];
+                        if (bits)
+                        {
+                                int step = 1 << (8-bits);
+                                scale[x*4+c] = ((1 << bits) - 1) * 64 * step;
+                                offset[x*4+c] = t * 255 * step;
+                        }
+                        else
+                        {
+                                scale[x*4+c] = DITHERUNIT;
+                                offset[x*4+c] = (t - 32) * DITHERSPREAD / 64 * DITHERUNIT;
+                        }
+                }
+                scale[x*4+3] = DITHERUNIT;      // alpha is kept
+                offset[x*4+3] = 0;
+        }
+
+        // plain loops of 8 pixels, the compiler vectorizes them
+        BYTE *b = (BYTE *)row;
+        long n = (long)count * 4;
+        long i = 0;
+        for (; i+32<=n; i+=32)
+        {
+                for (int j=0; j<32; j++) b[i+j] = DitherLevel(b[i+j], scale[j], offset[j]);
+        }
+        for (int j=0; i+j<n; j++) b[i+j] = DitherLevel(b[i+j], scale[j], offset[j]);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// QuantizePixel                                                            //
+//////////////////////////////////////////////////////////////////////////////
+inline void QuantizePixel(const Job *job, const int *v, RGBQUAD *p)
+{                                               // v is b, g, r; p gets the closest color the writer can output
+        BYTE *c = (BYTE *)p;
+
+        if (!job->ditherBits[0])
+        {
+                RGBQUAD q = *p;
+                q.rgbBlue = v[0]; q.rgbGreen = v[1]; q.rgbRed = v[2];
+                const RGBQUAD &color = job->palette->colors[NearestColor(job->palette, &q)];
+                p->rgbBlue = color.rgbBlue; p->rgbGreen = color.rgbGreen; p->rgbRed = color.rgbRed;
+                return;
+        }
+
+        // rounded to the nearest level; the expanded level has the level in its top bits
+        for (int ch=0; ch<3; ch++)
+        {
+                int bits = job->ditherBits[2-ch];
+                int levels = (1 << bits) - 1;
+                c[ch] = Expand((v[ch] * levels + 127) / 255, bits);
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// DiffuseImage                                                             //
+//////////////////////////////////////////////////////////////////////////////
+void DiffuseImage(const Job *job, RGBQUAD *image, int width, int height, int threads)
+{                                               // Floyd-Steinberg in place; rows are pipelined, each one follows the row above
+        // errors for the next row in 16ths, b, g, r per pixel; a row reads one buffer and writes the other
+        std::vector<int> errors[2];
+        errors[0].resize((long)width * 3);
+        errors[1].resize((long)width * 3);
+        std::vector<int> done(height, 0);       // pixels finished per row
+
+        auto diffuse = [&](int y)
+        {
+                const int *in = &errors[y & 1][0];
+                int *out = &errors[(y+1) & 1][0];
+                RGBQUAD *p = image + (long)width*y;
+                int ready = 0;
+                int e1[3] = { 0, 0, 0 }, e2[3] = { 0, 0, 0 };   // errors of pixels x-1 and x-2
+
+                for (int x=0; x<width; x++)
+                {
+                        // the row above has passed pixel x+1: the error for x is complete, x-1 has been read
+                        int need = MIN(width, x+2);
+                        while ((y > 0) && (ready < need))
+                        {
+                                ready = __atomic_load_n(&done[y-1], __ATOMIC_ACQUIRE);
+                                if (ready < need) std::this_thread::yield();
+                        }
+
+                        BYTE *c = (BYTE *)&p[x];
+                        int v[3], e[3];
+                        for (int ch=0; ch<3; ch++)
+                        {
+                                int error = 7*e1[ch] + (y ? in[x*3+ch] : 0);
+                                v[ch] = c[ch] + (error >= 0 ? error + 8 : error - 8) / 16;
+                                v[ch] = v[ch] < 0 ? 0 : v[ch] > 255 ? 255 : v[ch];
+                        }
+
+                        QuantizePixel(job, v, &p[x]);
+
+                        for (int ch=0; ch<3; ch++)
+                        {
+                                e[ch] = v[ch] - c[ch];
+                                if (x > 0) out[(x-1)*3+ch] = e2[ch] + 5*e1[ch] + 3*e[ch];
+                                e2[ch] = e1[ch];
+                                e1[ch] = e[ch];
+                        }
+
+                        if ((x & 15) == 15) __atomic_store_n(&done[y], x+1, __ATOMIC_RELEASE);
+                }
+
+                for (int ch=0; ch<3; ch++) out[(width-1)*3+ch] = e2[ch] + 5*e1[ch];
+                __atomic_store_n(&done[y], width, __ATOMIC_RELEASE);
+        };
+
+        threads = MAX(1, MIN(threads, height));
+        if (threads == 1) { for (int y=0; y<height; y++) diffuse(y); return; }
+
+        // row y runs on thread y % threads, the rows of a thread come in order
+        std::vector<std::thread> pool;
+        for (int t=0; t<threads; t++)
+        {
+                pool.push_back(std::thread([&, t]() { for (int y=t; y<height; y+=threads) diffuse(y); }));
+        }
+        for (size_t t=0; t<pool.size(); t++) pool[t].join();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// RunBands                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+void RunBands(int threads, int count, const std::function<void(int, int)> &band)
+{                                               // splits 0..count-1 into bands run by the worker threads
+        int bands = 1;
+        if (threads > 1) bands = MIN(threads*4, (count + BANDSIZE-1) / BANDSIZE);
+        if (bands <= 1) { band(0, count); return; }
+
+        std::atomic<int> next(0);
+        std::vector<std::thread> pool;
+        for (int t=0; t<MIN(threads, bands); t++)
+        {
+                pool.push_back(std::thread([&]()
+                {
+                        for (int i; (i = next++) < bands; ) band((long)count*i/bands, (long)count*(i+1)/bands);
+                }));
+        }
+        for (size_t t=0; t<pool.size(); t++) pool[t].join();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// OutputStyle                                                              //
+//////////////////////////////////////////////////////////////////////////////
+int OutputStyle(const char *name)
+{                                               // -1: raw binary, otherwise the source format picked by extension
+        const char *ext = strrchr(name, '.');
+        if (!ext || strpbrk(ext, "/\\")) return -1;
+        if (!strcmp(ext, ".s") || !strcmp(ext, ".S")) return BINFORMAT_ASM;
+        if (!strcmp(ext, ".c")) return BINFORMAT_C;
+        return -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WriteOutput                                                              //
+//////////////////////////////////////////////////////////////////////////////
+bool WriteOutput(const Job *job, const char *name, const gt_sink *sink, const BYTE *data, long size)
+{                                               // raw data to a sink, or a raw file, bin2s style .s or raw2c style .c and .h
+        gt_stats_sink counted;
+        int phase = gt_stats_phase(job->stats, GT_WRITE);
+
+        if (sink)
+        {
+                const gt_sink *target = gt_stats_wrap(&counted, job->stats, sink);
+                int err = target->write(target->context, data, size);
+                gt_stats_phase(job->stats, phase);
+                if (!err) return true;
+                Report(job, "Error writing output!\n");
+                return false;
+        }
+
+        int style = OutputStyle(name);
+
+        gt_stats_phase(job->stats, GT_OPEN);
+        if (job->stats) job->stats->opens++;
+        FILE *f = fopen(name, "wb");
+        if (!f) { gt_stats_phase(job->stats, phase); Report(job, "Error opening output file!\n"); return false; }
+
+        gt_sink file;
+        gt_file_sink(&file, f);
+        const gt_sink *out = gt_stats_wrap(&counted, job->stats, &file);
+        int err;
+
+        // symbols are named after the file, without directory and extension
+        std::string path(name);
+        std::string stem = path.substr(0, path.rfind('.'));
+        size_t slash = stem.find_last_of("/\\");
+        char ident[256];
+        binformat_ident(stem.c_str() + (slash == std::string::npos ? 0 : slash + 1), 0, ident, sizeof(ident));
+
+        if (style < 0)
+        {
+                err = out->write(out->context, data, size);
+        }
+        else if (style == BINFORMAT_C)
+        {
+                if (job->stats) job->stats->opens++;
+                FILE *fh = fopen((stem + ".h").c_str(), "wb");
+                if (!fh) { fclose(f); gt_stats_phase(job->stats, phase); Report(job, "Error opening output header file!\n"); return false; }
+                gt_sink header;
+                gt_stats_sink countedHeader;
+                gt_file_sink(&header, fh);
+                gt_stats_phase(job->stats, GT_FORMAT);
+                err = gt_raw2c(out, gt_stats_wrap(&countedHeader, job->stats, &header), ident, data, size);
+                gt_stats_phase(job->stats, GT_WRITE);
+                fclose(fh);
+        }
+        else
+        {
+                gt_stats_phase(job->stats, GT_FORMAT);
+                err = gt_bin2s(out, NULL, ident, data, size, 4, 0);
+                gt_stats_phase(job->stats, GT_WRITE);
+        }
+
+        fclose(f);
+        gt_stats_phase(job->stats, phase);
+        if (err) Report(job, "Error writing output!\n");
+        return !err;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ReadBand                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+bool ReadBand(const Job *job, int y0, int y1, RGBQUAD *image)
+{
+        RowReader r;
+        if (!OpenReader(job, &r)) { CloseReader(&r); Report(job, "Error opening bitmap file!\n"); return false; }
+
+        for (int y=y0; y<y1; y++) ReadRow(job, &r, y, image + (long)job->width*y);
+
+        CloseReader(&r);
+        return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ConvertBand                                                              //
+//////////////////////////////////////////////////////////////////////////////
+bool ConvertBand(const Job *job, int y0, int y1, const RGBQUAD *image, int rowWidth, BYTE *rows,
+                 const std::function<void(int y, const BYTE *line)> &output = nullptr)
+{                                               // image == NULL: convert straight from the bitmap; rows == NULL: lines go to output
+        RowReader r;
+        RGBQUAD *row = NULL;
+        if (!image)
+        {
+                row = new RGBQUAD[rowWidth + 1/*dummy*/];
+                if (!OpenReader(job, &r)) { CloseReader(&r); delete[] row; Report(job, "Error opening bitmap file!\n"); return false; }
+        }
+
+        // ordered dithering works on a copy of rows in memory
+        RGBQUAD *dithered = (image && (job->dither == 'b')) ? new RGBQUAD[rowWidth + 1/*dummy*/] : NULL;
+
+        long rowBytes = ROWBYTES(rowWidth, job->pixelBits);
+        BYTE *outLine = rows ? NULL : new BYTE[rowBytes];
+        for (int y=y0; y<y1; y++)
+        {
+                const RGBQUAD *p = image ? image + (long)rowWidth*y : row;
+                if (!image) ReadRow(job, &r, y, row);
+                if (job->dither == 'b')
+                {
+                        RGBQUAD *d = dithered ? dithered : row;
+                        if (dithered) memcpy(dithered, p, rowWidth * sizeof(RGBQUAD));
+                        DitherRow(job, d, rowWidth, y);
+                        p = d;
+                }
+                if (rows) ConvertRow(job, p, rowWidth, rows + y*rowBytes);
+                else { ConvertRow(job, p, rowWidth, outLine); output(y, outLine); }
+        }
+        delete[] outLine;
+        delete[] dithered;
+
+        if (!image) { CloseReader(&r); delete[] row; }
+        return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// TileBand                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+bool TileBand(const Job *job, int y0, int y1, const RGBQUAD *image, int rowWidth, int tileSize, BYTE *tiles)
+{                                               // scatters converted rows into tile order
+        int tileLine = tileSize * job->pixelBits / 8;
+        int tilesX = rowWidth / tileSize;
+
+        return ConvertBand(job, y0, y1, image, rowWidth, NULL, [&](int y, const BYTE *line)
+        {
+                BYTE *t = tiles + ((long)(y / tileSize) * tilesX * tileSize + y % tileSize) * tileLine;
+                for (int tx=0; tx<tilesX; tx++, t += tileSize*tileLine) memcpy(t, line + tx*tileLine, tileLine);
+        });
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// HashTile                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+unsigned long long HashTile(const BYTE *tile, int size)
+{
+        unsigned long long h = 0xcbf29ce484222325ULL;
+        int i = 0;
+
+        // a word at a time, tile sizes are multiples of 8 bytes
+        for (; i+8<=size; i+=8)
+        {
+                unsigned long long w;
+                memcpy(&w, tile + i, 8);
+                h = (h ^ w) * 0x100000001b3ULL;
+                h ^= h >> 29;
+        }
+        for (; i<size; i++) h = (h ^ tile[i]) * 0x100000001b3ULL;
+
+        return h;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// FlipTile                                                                 //
+//////////////////////////////////////////////////////////////////////////////
+void FlipTile(const BYTE *src, BYTE *dst, int tileSize, int pixelBits, int hflip, int vflip)
+{
+        int tileLine = tileSize * pixelBits / 8;
+        int pixelSize = pixelBits / 8;
+
+        for (int y=0; y<tileSize; y++)
+        {
+                const BYTE *s = src + (vflip ? tileSize-1-y : y) * tileLine;
+                BYTE *d = dst + y*tileLine;
+                if (!hflip) { memcpy(d, s, tileLine); continue; }
+                if (pixelBits == 4)
+                {
+                        // reverse the bytes and the nibbles within them
+                        for (int x=0; x<tileLine; x++) d[x] = (s[tileLine-1-x] >> 4) | (s[tileLine-1-x] << 4);
+                        continue;
+                }
+                for (int x=0; x<tileSize; x++) memcpy(d + x*pixelSize, s + (tileSize-1-x)*pixelSize, pixelSize);
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// DedupeTiles                                                              //
+//////////////////////////////////////////////////////////////////////////////
+int DedupeTiles(BYTE *tiles, int count, int tileSize, int pixelBits, WORD *map)
+{                                               // compacts tiles to the unique set, returns its size
+        int tileBytes = tileSize * tileSize * pixelBits / 8;
+        std::unordered_multimap<unsigned long long, int> known;        // hash of unique tile -> index
+        BYTE *variant = new BYTE[tileBytes];
+        int unique = 0;
+
+        known.reserve(count);
+
+        for (int t=0; t<count; t++)
+        {
+                const BYTE *tile = tiles + (long)t*tileBytes;
+                int entry = -1;
+
+                // flips are their own inverse: a flipped tile matching a known tile is that tile flipped
+                for (int f=0; f<4 && entry<0; f++)
+                {
+                        const BYTE *v = tile;
+                        if (f) { FlipTile(tile, variant, tileSize, pixelBits, f & 1, f & 2); v = variant; }
+
+                        unsigned long long h = HashTile(v, tileBytes);
+                        std::pair<std::unordered_multimap<unsigned long long, int>::iterator,
+                                  std::unordered_multimap<unsigned long long, int>::iterator> range = known.equal_range(h);
+                        for (; range.first != range.second; ++range.first)
+                        {
+                                int u = range.first->second;
+                                if (memcmp(tiles + (long)u*tileBytes, v, tileBytes) == 0)
+                                {
+                                        entry = u | ((f & 1) ? TILE_HFLIP : 0) | ((f & 2) ? TILE_VFLIP : 0);
+                                        break;
+                                }
+                        }
+                }
+
+                if (entry < 0)
+                {
+                        if (unique != t) memcpy(tiles + (long)unique*tileBytes, tile, tileBytes);
+                        known.insert(std::make_pair(HashTile(tile, tileBytes), unique));
+                        entry = unique++;
+                }
+
+                map[t] = entry;
+        }
+
+        delete[] variant;
+        return unique;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// SpriteHeader                                                             //
+//////////////////////////////////////////////////////////////////////////////
+// Mr.Mirko 2004
+/*
+typedef struct {
+  char magic[4];
+  u16 size_x;
+  u16 size_y;
+  u16 reserved1;
+  u16 reserved2;
+} SHEADER; */
+int SpriteHeader(BYTE *o, int width, int height)
+{
+        char sdk[]="Mr.M";
+        short reserved=0;
+        short x = width;
+        short y = height;
+
+        memcpy(o, sdk, 4);              // 4 bytes
+        memcpy(o+4, &x, 2);             // 1 short
+        memcpy(o+6, &y, 2);             // 1 short
+        memcpy(o+8, &reserved, 2);      // 1 short
+        memcpy(o+10, &reserved, 2);     // 1 short
+        return SPRITEHEADERSIZE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// EncodeImage                                                              //
+//////////////////////////////////////////////////////////////////////////////
+long EncodeImage(const Job *job, const RGBQUAD *image, int width, int height, int tileSize, BYTE *out)
+{                                               // converts an image in memory, returns the size written
+        long size = 0;
+        long rowBytes = ROWBYTES(width, job->pixelBits);
+
+        if (job->flags['x']) size += SpriteHeader(out, width, height);
+
+        if (tileSize) TileBand(job, 0, height, image, width, tileSize, out + size);
+        else ConvertBand(job, 0, height, image, width, out + size);
+
+        return size + rowBytes*height;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ParseSlices                                                              //
+//////////////////////////////////////////////////////////////////////////////
+bool ParseSlices(const Job *job, std::vector<Frame> &frames)
+{
+        const char *spec = job->sliceSpec;
+
+        if (spec[0] == '@')
+        {
+                // rectangle list, one "x y width height" per line
+                FILE *f = fopen(spec+1, "r");
+                if (!f) { Report(job, "Error opening slice file!\n"); return false; }
+
+                char line[256];
+                while (fgets(line, sizeof(line), f))
+                {
+                        char *c = line + strspn(line, " \t\r\n");
+                        if (!*c || (*c == '#')) continue;
+                        for (; *c; c++) if (*c == ',') *c = ' ';
+
+                        Frame frame;
+                        if (sscanf(line, "%d %d %d %d", &frame.x, &frame.y, &frame.width, &frame.height) != 4) { fclose(f); return false; }
+                        frames.push_back(frame);
+                }
+                fclose(f);
+        }
+        else
+        {
+                // grid, frames taken left to right and top to bottom
+                int frameWidth, frameHeight, count = 0, padding = 0;
+                if (sscanf(spec, "%dx%d,%d,%d", &frameWidth, &frameHeight, &count, &padding) < 2) return false;
+                if ((frameWidth <= 0) || (frameHeight <= 0) || (padding < 0)) return false;
+
+                int columns = (job->width + padding) / (frameWidth + padding);
+                int rows = (job->height + padding) / (frameHeight + padding);
+                if ((count <= 0) || (count > columns*rows)) count = columns*rows;
+
+                for (int i=0; i<count; i++)
+                {
+                        Frame frame = { (i % columns) * (frameWidth + padding), (i / columns) * (frameHeight + padding), frameWidth, frameHeight };
+                        frames.push_back(frame);
+                }
+        }
+
+        for (size_t i=0; i<frames.size(); i++)
+        {
+                const Frame &frame = frames[i];
+                if ((frame.x < 0) || (frame.y < 0) || (frame.width <= 0) || (frame.height <= 0) ||
+                    (frame.x + frame.width > job->width) || (frame.y + frame.height > job->height)) return false;
+        }
+
+        return !frames.empty();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Slice                                                                    //
+//////////////////////////////////////////////////////////////////////////////
+int Slice(const Job *job, int threads, int mode, int tileSize)
+{                                               // cuts frames out of a spritesheet decoded once
+        std::vector<Frame> frames;
+        if (!ParseSlices(job, frames)) { Report(job, "Invalid slice specification!\n"); return -1; }
+        int count = frames.size();
+
+        // an output name with a %d gets one file per frame, otherwise frames are concatenated after
+        // a table of the frame count and each frame's offset (32 bits each), as is a sink
+        const char *percent = job->outputSink ? NULL : strchr(job->outputFile, '%');
+        bool perFrame = percent != NULL;
+        if (perFrame)
+        {
+                const char *c = percent + 1;
+                while ((*c >= '0') && (*c <= '9')) c++;
+                if ((*c != 'd') || strchr(c, '%')) { Report(job, "Output name must contain a single %%d!\n"); return -1; }
+        }
+
+        // frame layout
+        std::vector<long> offsets(count + 1);
+        offsets[0] = perFrame ? 0 : 4 * (count + 1);
+        for (int i=0; i<count; i++)
+        {
+                int w = (mode & 1) ? frames[i].height : frames[i].width;
+                int h = (mode & 1) ? frames[i].width : frames[i].height;
+                if (tileSize && ((w % tileSize) || (h % tileSize))) { Report(job, "Frame size is not a multiple of the tile size!\n"); return -1; }
+                offsets[i+1] = offsets[i] + (job->flags['x'] ? SPRITEHEADERSIZE : 0) + ROWBYTES(w, job->pixelBits) * h;
+        }
+
+        // decode the sheet once
+        std::atomic<bool> failed(false);
+        RGBQUAD *imageData = new RGBQUAD[job->pixelCount + 1/*dummy*/];
+        RunBands(threads, job->height, [&](int y0, int y1) { if (!ReadBand(job, y0, y1, imageData)) failed = true; });
+        if (failed) { delete[] imageData; return -1; }
+
+        BYTE *out = new BYTE[offsets[count]];
+        for (int i=0; i<=count && !perFrame; i++)
+        {
+                DWORD v = endiaDW(i ? offsets[i-1] : count);
+                memcpy(out + 4*i, &v, 4);
+        }
+
+        RunBands(threads, count, [&](int f0, int f1)
+        {
+                for (int i=f0; i<f1; i++)
+                {
+                        const Frame &frame = frames[i];
+                        RGBQUAD *frameData = new RGBQUAD[(long)frame.width * frame.height + 1/*dummy*/];
+                        for (int y=0; y<frame.height; y++)
+                        {
+                                memcpy(frameData + (long)frame.width*y, imageData + (long)job->width*(frame.y+y) + frame.x, frame.width * sizeof(RGBQUAD));
+                        }
+
+                        int w = frame.width, h = frame.height;
+                        if (mode)
+                        {
+                                RGBQUAD *transformed = new RGBQUAD[(long)w * h + 1/*dummy*/];
+                                Transform(frameData, transformed, w, h, mode, 0, w);
+                                delete[] frameData;
+                                frameData = transformed;
+                                if (mode & 1) { w = frame.height; h = frame.width; }
+                        }
+
+                        // frames run in parallel, each one is diffused on its own
+                        if (job->dither == 'f') DiffuseImage(job, frameData, w, h, 1);
+
+                        EncodeImage(job, frameData, w, h, tileSize, out + offsets[i]);
+                        delete[] frameData;
+                }
+        });
+        delete[] imageData;
+
+        // write
+        for (int i=0; i<(perFrame ? count : 1) && !failed; i++)
+        {
+                char name[4096];
+                if (perFrame) snprintf(name, sizeof(name), job->outputFile, i);
+                if (perFrame) { if (!WriteOutput(job, name, NULL, out + offsets[i], offsets[i+1] - offsets[i])) failed = true; }
+                else if (!WriteOutput(job, job->outputFile, job->outputSink, out, offsets[count])) failed = true;
+        }
+        delete[] out;
+
+        Report(job, "  %d frames\n", count);
+        return failed ? -1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ReadMasks                                                                //
+//////////////////////////////////////////////////////////////////////////////
+bool ReadMasks(Job *job, RowReader *in)
+{                                               // bit fields of 16 and 32 bit bitmaps, picks the pixel decoder
+        int bitCount = endiaW(job->bih.biBitCount);
+        int compression = endiaDW(job->bih.biCompression);
+        DWORD headerSize = endiaDW(job->bih.biSize);
+        DWORD *masks = job->masks;
+
+        memset(masks, 0, sizeof(job->masks));
+
+        if ((compression == BI_BITFIELDS) || (compression == BI_ALPHABITFIELDS))
+        {
+                // masks follow the 40 byte header, or are part of a V2-V5 header
+                int count = 3;
+                if ((compression == BI_ALPHABITFIELDS) || (headerSize >= 56)) count = 4;
+                if (ReadAt(job, in, sizeof(job->bfh) + sizeof(job->bih), masks, count * sizeof(DWORD)) != count * (long)sizeof(DWORD)) return false;
+                for (int i=0; i<4; i++) masks[i] = endiaDW(masks[i]);
+        }
+        else if (bitCount == 16)
+        {
+                masks[0] = 0x7C00; masks[1] = 0x03E0; masks[2] = 0x001F;
+        }
+        else
+        {
+                masks[0] = 0x00FF0000; masks[1] = 0x0000FF00; masks[2] = 0x000000FF;
+        }
+
+        if (bitCount == 16) masks[3] &= 0xFFFF;
+        job->alpha = masks[3] != 0;
+
+        for (int i=0; i<4; i++)
+        {
+                DWORD m = masks[i];
+                int shift = 0, bits = 0;
+                if (m) { while (!(m & 1)) { m >>= 1; shift++; } }
+                while (m & 1) { m >>= 1; bits++; }
+                if (m) return false;                    // not contiguous
+                job->maskShift[i] = shift;
+                job->maskBits[i] = bits;
+        }
+        if (!masks[0] && !masks[1] && !masks[2]) return false;
+
+        // common layouts get their own decoder
+        job->inputFormat = INPUT_BITFIELDS;
+        if ((masks[0] == 0x00FF0000) && (masks[1] == 0x0000FF00) && (masks[2] == 0x000000FF))
+        {
+                if (masks[3] == 0xFF000000) job->inputFormat = INPUT_BGRA8888;
+                else if (masks[3] == 0) job->inputFormat = INPUT_BGRX8888;
+        }
+        else if ((masks[0] == 0xF800) && (masks[1] == 0x07E0) && (masks[2] == 0x001F) && (masks[3] == 0))
+        {
+                job->inputFormat = INPUT_RGB565;
+        }
+        else if ((masks[0] == 0x7C00) && (masks[1] == 0x03E0) && (masks[2] == 0x001F))
+        {
+                if (masks[3] == 0x8000) job->inputFormat = INPUT_ARGB1555;
+                else if (masks[3] == 0) job->inputFormat = INPUT_XRGB1555;
+        }
+
+        return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ReadHeaders                                                              //
+//////////////////////////////////////////////////////////////////////////////
+bool ReadHeaders(Job *job, RowReader *in)
+{                                               // reads and checks everything before anything is allocated for the image
+        long long fileSize = InputSize(job, in);
+        if ((ReadAt(job, in, 0, &job->bfh, sizeof(job->bfh)) != sizeof(job->bfh)) ||
+            (ReadAt(job, in, sizeof(job->bfh), &job->bih, sizeof(job->bih)) != sizeof(job->bih)) ||
+            (endiaW(job->bfh.bfType) != 0x4D42/*BM*/) ||
+            (endiaDW(job->bih.biSize) < sizeof(job->bih))) { Report(job, "Not a bitmap file!\n"); return false; }
+
+        // checks
+        int bitCount = endiaW(job->bih.biBitCount);
+        int compression = endiaDW(job->bih.biCompression);
+        if (endiaW(job->bih.biPlanes) != 1) { Report(job, "Unsupported number of planes!\n"); return false; }
+        if ((compression != BI_RGB) &&
+            !((compression == BI_RLE8) && (bitCount == 8)) &&
+            !((compression == BI_RLE4) && (bitCount == 4)) &&
+            !(((compression == BI_BITFIELDS) || (compression == BI_ALPHABITFIELDS)) && ((bitCount == 16) || (bitCount == 32)))) { Report(job, "Unsupported compression type!\n"); return false; }
+        if ((bitCount != 1) && (bitCount != 4) && (bitCount != 8) && (bitCount != 16) && (bitCount != 24) && (bitCount != 32)) { Report(job, "Unsupported bit depth!\n"); return false; }
+
+        // sizes in 64 bits: every image buffer holds at most width * height + 1 pixels of 4 bytes
+        long long width = endiaL(job->bih.biWidth);
+        long long height = endiaL(job->bih.biHeight);
+        job->topDown = height < 0;
+        if (job->topDown) height = -height;
+        if ((width <= 0) || (height <= 0)) { Report(job, "Invalid image size!\n"); return false; }
+
+        unsigned long long maxPixels = MIN((unsigned long long)LONG_MAX, (unsigned long long)SIZE_MAX) / sizeof(RGBQUAD) - 1;
+        long long lineSize = ALIGN4((width * bitCount + 7) / 8);
+        if (((unsigned long long)(width * height) > maxPixels) || (lineSize > INT_MAX)) { Report(job, "Image too large!\n"); return false; }
+
+        job->width = width;
+        job->height = height;
+        job->lineSize = lineSize;
+        job->pixelCount = width * height;
+
+        // the pixel data follows the headers and, unless it is compressed, holds every row;
+        // the padding of the last row may be missing
+        long long offset = endiaDW(job->bfh.bfOffBits);
+        long long headersEnd = sizeof(job->bfh) + (long long)endiaDW(job->bih.biSize);
+        if (headersEnd > fileSize) { Report(job, "Truncated bitmap file!\n"); return false; }
+        if ((offset < headersEnd) || (offset >= fileSize)) { Report(job, "Invalid pixel data offset!\n"); return false; }
+
+        if ((compression == BI_RLE8) || (compression == BI_RLE4))
+        {
+                // the data size limits the decoded size, beyond anything runs can encode
+                job->dataSize = fileSize - offset;
+                if ((unsigned long long)job->pixelCount > MAX((unsigned long long)job->dataSize * RLEEXPANSION, (unsigned long long)RLEMINPIXELS)) { Report(job, "Image too large for its RLE data!\n"); return false; }
+        }
+        else
+        {
+                job->dataSize = lineSize * (height - 1) + (width * bitCount + 7) / 8;
+                if (offset + job->dataSize > fileSize) { Report(job, "Truncated bitmap file!\n"); return false; }
+        }
+
+        // check bit depth
+        if (bitCount <= 8)
+        {
+                Report(job, "  The BMP is a %dbits image..\n", bitCount);
+                // read palette (quads, alpha unused), the palette follows the info header
+                RGBQUAD paletteQ[256];
+                int colors = endiaDW(job->bih.biClrUsed);
+                if ((colors <= 0) || (colors > (1 << bitCount))) colors = 1 << bitCount;
+                memset(paletteQ, 0, sizeof(paletteQ));
+                if (headersEnd + colors * (long long)sizeof(RGBQUAD) > fileSize) { Report(job, "Truncated bitmap file!\n"); return false; }
+                ReadAt(job, in, headersEnd, paletteQ, colors * sizeof(RGBQUAD));
+                for (int i=0; i<256; i++)
+                {
+                        job->bmpPalette[i].rgbRed = paletteQ[i].rgbRed;
+                        job->bmpPalette[i].rgbGreen = paletteQ[i].rgbGreen;
+                        job->bmpPalette[i].rgbBlue = paletteQ[i].rgbBlue;
+                        job->bmpPalette[i].rgbReserved = 0xFF;
+                }
+        }
+        else if (bitCount == 24)
+        {
+                Report(job, "  The BMP is a 24bits image..\n");
+        }
+        else
+        {
+                Report(job, "  The BMP is a %dbits image..\n", bitCount);
+                if (!ReadMasks(job, in)) { Report(job, "Unsupported bit fields!\n"); return false; }
+        }
+
+        return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ParsePaletteText                                                         //
+//////////////////////////////////////////////////////////////////////////////
+bool ParsePaletteText(char *text, Palette *palette)
+{                                               // JASC-PAL (Paint Shop Pro) and GIMP GPL palettes
+        bool jasc = !strncmp(text, "JASC-PAL", 8);
+        int header = jasc ? 3 : 1;              // JASC-PAL: magic, version and count, GPL: magic
+        int count = 256;
+        int line = 0;
+
+        for (char *c = text, *next; *c && (palette->count < count); c = next, line++)
+        {
+                next = c + strcspn(c, "\n");
+                if (*next) *next++ = 0;
+
+                if (line < header)
+                {
+                        if (jasc && (line == 2)) count = MIN(atoi(c), 256);
+                        continue;
+                }
+
+                // GPL: "Name:" and "Columns:" settings, comments, blank lines
+                c += strspn(c, " \t\r");
+                if (!*c || (*c == '#') || ((*c < '0' || *c > '9') && !jasc)) continue;
+
+                int r, g, b;
+                if (sscanf(c, "%d %d %d", &r, &g, &b) != 3) return false;
+                RGBQUAD &q = palette->colors[palette->count++];
+                q.rgbRed = r; q.rgbGreen = g; q.rgbBlue = b; q.rgbReserved = 0xFF;
+        }
+
+        return palette->count > 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ParsePalette                                                             //
+//////////////////////////////////////////////////////////////////////////////
+bool ParsePalette(const BYTE *data, long size, Palette *palette)
+{                                               // palette file contents, raw .act style or text
+        memset(palette, 0, sizeof(Palette));
+
+        if (((size >= 8) && !memcmp(data, "JASC-PAL", 8)) || ((size >= 12) && !memcmp(data, "GIMP Palette", 12)))
+        {
+                std::string text((const char *)data, size);
+                return ParsePaletteText(&text[0], palette);
+        }
+
+        if ((size == 3*256) || (size == 3*256+4) || (size == 3*16) || (size == 4*256) || (size == 4*16))
+        {
+                // raw r,g,b... or r,g,b,x..., 16 or 256 colors; .act files may end in a color count
+                int stride = ((size == 4*256) || (size == 4*16)) ? 4 : 3;
+                palette->count = (size >= 3*256) ? 256 : 16;
+                if (size == 3*256+4)
+                {
+                        int count = (data[768] << 8) | data[769];
+                        if ((count > 0) && (count <= 256)) palette->count = count;
+                }
+
+                for (int i=0; i<palette->count; i++)
+                {
+                        palette->colors[i].rgbRed = data[i*stride+0];
+                        palette->colors[i].rgbGreen = data[i*stride+1];
+                        palette->colors[i].rgbBlue = data[i*stride+2];
+                        palette->colors[i].rgbReserved = 0xFF;
+                }
+                return true;
+        }
+
+        return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// PaletteWriter                                                            //
+//////////////////////////////////////////////////////////////////////////////
+WritePixel *PaletteWriter(int format)
+{                                               // palette entry encoder of a pixel format flag
+        switch (format)
+        {
+                case 'p': return WritePixelGP32;
+                case 'q': return WritePixelGP2X;
+                case 'g': case 'd': return WritePixelGB;
+                case 't': return WritePixel24;
+                case 'e': return WritePixel8;
+        }
+        return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// WritePalette                                                             //
+//////////////////////////////////////////////////////////////////////////////
+bool WritePalette(const Job *job, const RGBQUAD *colors, int count)
+{                                               // GP32 text by default, binary (or a source module) in any pixel format
+        if (!job->paletteFormat && (job->paletteSink || (OutputStyle(job->outPaletteFile) < 0)))
+        {
+                char text[256*7];
+                return WriteOutput(job, job->outPaletteFile, job->paletteSink, (const BYTE *)text, writePaletteGP(colors, count, text));
+        }
+
+        // a source module without -o gets the GP32 entries
+        WritePixel *writePixel = PaletteWriter(job->paletteFormat ? job->paletteFormat : 'p');
+        BYTE entries[256*3];
+        BYTE *o = entries;
+        for (int i=0; i<count; i++) o = writePixel(job, &colors[i], o);
+
+        return WriteOutput(job, job->outPaletteFile, job->paletteSink, entries, o - entries);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Convert                                                                  //
+//////////////////////////////////////////////////////////////////////////////
+int Convert(Job *job)
+{
+        char *flags = job->flags;
+        bool dedupe = job->mapFile || job->mapSink;
+
+        // the quantization palette is loaded by the caller
+        if (flags['1'] && !job->palette) { Report(job, "No palette given!\n"); return -1; }
+
+        // outpalette
+        if (job->paletteFormat && !PaletteWriter(job->paletteFormat)) { Report(job, "Unknown palette output format!\n"); return -1; }
+
+        // read headers
+        {
+                // open bitmap file
+                gt_stats_phase(job->stats, GT_OPEN);
+                RowReader in = { NULL, -1, NULL, NULL };
+                if (!job->inputData && ((in.f = fopen(job->inputFile, "rb")) == NULL)) { Report(job, "Error opening bitmap file!\n"); return -1; }
+                if (in.f && job->stats) job->stats->opens++;
+
+                // read and check headers
+                if (!ReadHeaders(job, &in)) { CloseReader(&in); return -1; }
+
+                // RLE bitmaps are decoded up front, rows can't be located in the compressed data
+                int compression = endiaDW(job->bih.biCompression);
+                if ((compression == BI_RLE8) || (compression == BI_RLE4))
+                {
+                        gt_stats_phase(job->stats, GT_READ);
+                        BYTE *data = new BYTE[job->dataSize];
+                        long size = ReadAt(job, &in, endiaDW(job->bfh.bfOffBits), data, job->dataSize);
+
+                        job->indexData = new BYTE[job->pixelCount];
+                        memset(job->indexData, 0, job->pixelCount);
+                        bool ok = DecodeRLE(job, data, size, job->indexData);
+                        delete[] data;
+                        if (!ok)
+                        {
+                                Report(job, "Truncated RLE data!\n");
+                                CloseReader(&in);
+                                delete[] job->indexData;
+                                job->indexData = NULL;
+                                return -1;
+                        }
+                }
+
+                // close file
+                CloseReader(&in);
+        }
+
+        int width = job->width;
+        int height = job->height;
+        int threads = job->threads;
+        if (threads <= 0) threads = MAX(1, (int)std::thread::hardware_concurrency());
+
+        // select pixel writer
+        job->writePixel = WritePixelGP32; job->pixelBits = 16;
+        if (flags['p']) { job->writePixel = WritePixelGP32; job->pixelBits = 16; }
+	if (flags['q']) { job->writePixel = WritePixelGP2X; job->pixelBits = 16; }
+        if (flags['g'] || flags['d'] ) { job->writePixel = WritePixelGB; job->pixelBits = 16; }
+        if (flags['i']) { job->writePixel = WritePixelGP8; job->pixelBits = 8; }
+        if (flags['n']) { job->writePixel = NULL; job->pixelBits = 4; }        // packed by ConvertRow
+        if (flags['e']) { job->writePixel = WritePixel8; job->pixelBits = 8; }
+        if (flags['t']) { job->writePixel = WritePixel24; job->pixelBits = 24; }
+        if (flags['1']) { job->writePixel = WritePixelP1; job->pixelBits = 8; }
+
+        // dithering: the channel bits the writer keeps, none for the quantization palette
+        if (job->dither)
+        {
+                int bits[3] = { 5, 5, 5 };
+                bool ok = (job->dither == 'b') || (job->dither == 'f');
+                if (job->writePixel == WritePixelGP2X) bits[1] = 6;
+                else if (job->writePixel == WritePixel8) { bits[0] = 3; bits[1] = 3; bits[2] = 2; }
+                else if (job->writePixel == WritePixelP1) bits[0] = bits[1] = bits[2] = 0;
+                else if ((job->writePixel != WritePixelGP32) && (job->writePixel != WritePixelGB)) ok = false;
+
+                if (!ok)
+                {
+                        Report(job, "Dithering needs -D b or -D f and 15/16 bits, -e or -1 output!\n");
+                        delete[] job->indexData;
+                        job->indexData = NULL;
+                        return -1;
+                }
+                memcpy(job->ditherBits, bits, sizeof(bits));
+        }
+
+        // output palette: the bitmap's for LUT output, 16 colors with -n, or the quantization palette
+        if (job->outPaletteFile || job->paletteSink)
+        {
+                const RGBQUAD *colors = NULL;
+                if (flags['1'] && job->palette) colors = job->palette->colors;
+                else if ((flags['i'] || flags['n']) && (endiaW(job->bih.biBitCount) <= 8)) colors = job->bmpPalette;
+
+                if (colors && !WritePalette(job, colors, flags['n'] ? 16 : 256))
+                {
+                        delete[] job->indexData;
+                        job->indexData = NULL;
+                        return -1;
+                }
+        }
+
+        // rows are read, converted and, for raw output, written by the bands: all of it counts as convert
+        gt_stats_phase(job->stats, GT_CONVERT);
+
+        // transform?
+        int mode = (flags['r'] + 2*flags['u'] + 3*flags['l']) & XFORM_ROTATE_MASK;
+        if (flags['f']) mode |= XFORM_FLIPX;
+        if (flags['v']) mode |= XFORM_FLIPY;
+
+        // tiled?
+        int tileSize = flags['C'] ? 16 : (flags['c'] || dedupe) ? 8 : 0;
+
+        // spritesheet?
+        if (job->sliceSpec)
+        {
+                int result = -1;
+                if (dedupe) Report(job, "Tile deduplication can't be combined with slicing!\n");
+                else result = Slice(job, threads, mode, tileSize);
+                delete[] job->indexData;
+                job->indexData = NULL;
+                return result;
+        }
+
+        // write
+        {
+                int outWidth = (mode & 1) ? height : width;
+                int outHeight = (mode & 1) ? width : height;
+
+                if (tileSize && ((outWidth % tileSize) || (outHeight % tileSize)))
+                {
+                        Report(job, "Image size is not a multiple of the tile size!\n");
+                        delete[] job->indexData;
+                        job->indexData = NULL;
+                        return -1;
+                }
+
+                // raw output is written in place by the bands, source output is formatted from memory
+                bool raw = !job->outputSink && (OutputStyle(job->outputFile) < 0);
+                long headerSize = flags['x'] ? SPRITEHEADERSIZE : 0;
+                BYTE header[SPRITEHEADERSIZE];
+
+                if (flags['x'])
+                {
+                  if (flags['r']) { Report(job, "Please dont rotate Sprite...\n"); }
+
+                  // the header has always carried the size of the bitmap, a transform doesn't change it
+                  Report(job, "X: %d\n",width);
+                  Report(job, "Y: %d\n",height);
+                  SpriteHeader(header, width, height);
+                }
+
+                // raw output is sized up front and mapped, the bands convert straight into it
+                gt_output_map mapped;
+                long rawSize = headerSize + ROWBYTES(outWidth, job->pixelBits) * outHeight;
+                if (raw && !tileSize)
+                {
+                        gt_stats_phase(job->stats, GT_OPEN);
+                        if (gt_map_output(&mapped, job->outputFile, 0, rawSize, 0) != 0)
+                        {
+                                Report(job, "Error opening output file!\n");
+                                delete[] job->indexData;
+                                job->indexData = NULL;
+                                return -1;
+                        }
+                        memcpy(mapped.data, header, headerSize);
+                        if (job->stats) { job->stats->opens++; job->stats->bytesOut += rawSize; }
+                        gt_stats_phase(job->stats, GT_CONVERT);
+                }
+
+                std::atomic<bool> failed(false);
+                RGBQUAD *outData = NULL;
+
+                if (mode || (job->dither == 'f'))
+                {
+                        // transforms and error diffusion need the whole image
+                        RGBQUAD *imageData = new RGBQUAD[job->pixelCount + 1/*dummy*/];
+                        gt_stats_phase(job->stats, GT_READ);
+                        RunBands(threads, height, [&](int y0, int y1) { if (!ReadBand(job, y0, y1, imageData)) failed = true; });
+                        gt_stats_phase(job->stats, GT_CONVERT);
+
+                        outData = imageData;
+                        if (mode)
+                        {
+                                outData = new RGBQUAD[job->pixelCount + 1/*dummy*/];
+                                RunBands(threads, width, [&](int x0, int x1) { Transform(imageData, outData, width, height, mode, x0, x1); });
+                                delete[] imageData;
+                        }
+
+                        if (!failed && (job->dither == 'f')) DiffuseImage(job, outData, outWidth, outHeight, threads);
+                }
+
+                if (tileSize)
+                {
+                        int tileBytes = tileSize * tileSize * job->pixelBits / 8;
+                        int tileCount = (outWidth / tileSize) * (outHeight / tileSize);
+                        BYTE *out = new BYTE[headerSize + (long)tileCount * tileBytes];
+                        BYTE *tiles = out + headerSize;
+                        memcpy(out, header, headerSize);
+
+                        if (!failed) RunBands(threads, outHeight, [&](int y0, int y1) { if (!TileBand(job, y0, y1, outData, outWidth, tileSize, tiles)) failed = true; });
+
+                        int uniqueCount = tileCount;
+                        if (!failed && dedupe)
+                        {
+                                WORD *map = new WORD[tileCount];
+                                uniqueCount = DedupeTiles(tiles, tileCount, tileSize, job->pixelBits, map);
+
+                                Report(job, "  %d tiles, %d unique, %ld bytes of VRAM saved\n",
+                                        tileCount, uniqueCount, (long)(tileCount - uniqueCount) * tileBytes);
+
+                                if (uniqueCount > MAXTILES)
+                                {
+                                        Report(job, "Too many unique tiles for a tilemap!\n");
+                                        failed = true;
+                                }
+                                else
+                                {
+                                        for (int t=0; t<tileCount; t++) map[t] = endiaW(map[t]);
+                                        if (!WriteOutput(job, job->mapFile, job->mapSink, (const BYTE *)map, tileCount * sizeof(WORD))) failed = true;
+                                }
+                                delete[] map;
+                        }
+
+                        if (!failed && !WriteOutput(job, job->outputFile, job->outputSink, out, headerSize + (long)uniqueCount * tileBytes)) failed = true;
+                        delete[] out;
+                }
+                else if (!raw)
+                {
+                        long rowBytes = ROWBYTES(outWidth, job->pixelBits);
+                        BYTE *out = new BYTE[headerSize + rowBytes * outHeight];
+                        memcpy(out, header, headerSize);
+
+                        if (!failed) RunBands(threads, outHeight, [&](int y0, int y1)
+                        {
+                                if (!ConvertBand(job, y0, y1, outData, outWidth, out + headerSize)) failed = true;
+                        });
+
+                        if (!failed && !WriteOutput(job, job->outputFile, job->outputSink, out, headerSize + rowBytes * outHeight)) failed = true;
+                        delete[] out;
+                }
+                else
+                {
+                        // every band converts into its own place in the output, without a transform
+                        // straight from the bitmap row by row
+                        if (!failed) RunBands(threads, outHeight, [&](int y0, int y1)
+                        {
+                                if (!ConvertBand(job, y0, y1, outData, outWidth, mapped.data + headerSize)) failed = true;
+                        });
+
+                        gt_stats_phase(job->stats, GT_WRITE);
+                        if (gt_unmap_output(&mapped) != 0) { Report(job, "Error writing output!\n"); failed = true; }
+                }
+
+                delete[] outData;
+                delete[] job->indexData;
+                job->indexData = NULL;
+                if (failed) return -1;
+        }
+
+        return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// gt_bmp2bin                                                               //
+//////////////////////////////////////////////////////////////////////////////
+int gt_bmp2bin(const void *bitmap, size_t size, const gt_sink *out, const gt_bmp2bin_options *options)
+{                                               // libgeneraltools entry point, all state lives in the job
+        Job *job = new Job();
+        Palette palette;
+
+        job->inputData = (const BYTE *)bitmap;
+        job->inputSize = size;
+        job->outputSink = out;
+        job->threads = 1;
+
+        if (options)
+        {
+                for (const char *c = options->flags; c && *c; c++) job->flags[(BYTE)*c]++;
+                job->threads = options->threads;
+                job->paletteFormat = options->paletteFormat;
+                job->dither = options->dither;
+                job->sliceSpec = (char *)options->slices;
+                job->paletteSink = options->paletteOut;
+                job->mapSink = options->map;
+                job->log = options->log;
+                job->stats = options->stats;
+
+                if (options->palette)
+                {
+                        if (!ParsePalette((const BYTE *)options->palette, options->paletteSize, &palette))
+                        {
+                                Report(job, "Unknown palette format!\n");
+                                delete job;
+                                return -1;
+                        }
+                        job->palette = &palette;
+                }
+        }
+
+        int result = Convert(job);
+        delete job;
+        return result;
+}
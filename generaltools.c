@@ -0,0 +1,448 @@
+/*---------------------------------------------------------------------------------
+
+libgeneraltools: sinks and the bin2s, raw2c and padbin conversions
+
+---------------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+#include "generaltools.h"
+#include "binformat.h"
+
+//---------------------------------------------------------------------------------
+static int file_write(void *context, const void *data, size_t size) {
+//---------------------------------------------------------------------------------
+	return fwrite(data, 1, size, (FILE *)context) == size ? 0 : -1;
+}
+
+//---------------------------------------------------------------------------------
+static int buffer_write(void *context, const void *data, size_t size) {
+//---------------------------------------------------------------------------------
+	gt_buffer *buffer = (gt_buffer *)context;
+
+	if (buffer->size + size > buffer->capacity) {
+		size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+		while (capacity < buffer->size + size) capacity *= 2;
+
+		unsigned char *data = (unsigned char *)realloc(buffer->data, capacity);
+		if (!data) return -1;
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+	return 0;
+}
+
+//---------------------------------------------------------------------------------
+void gt_file_sink(gt_sink *sink, FILE *f) {
+//---------------------------------------------------------------------------------
+	sink->write = file_write;
+	sink->context = f;
+}
+
+//---------------------------------------------------------------------------------
+void gt_buffer_sink(gt_sink *sink, gt_buffer *buffer) {
+//---------------------------------------------------------------------------------
+	sink->write = buffer_write;
+	sink->context = buffer;
+}
+
+//---------------------------------------------------------------------------------
+void gt_buffer_free(gt_buffer *buffer) {
+//---------------------------------------------------------------------------------
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = buffer->capacity = 0;
+}
+
+//---------------------------------------------------------------------------------
+int gt_map_output(gt_output_map *map, const char *name, unsigned long long offset, size_t size, int keep) {
+//---------------------------------------------------------------------------------
+	memset(map, 0, sizeof(*map));
+	map->name = name;
+	map->offset = offset;
+	map->size = size;
+	map->keep = keep;
+	map->fd = -1;
+
+#ifndef _WIN32
+	map->fd = open(name, O_RDWR | O_CREAT | (keep ? 0 : O_TRUNC), 0666);
+	if (map->fd < 0) return -1;
+
+	if (ftruncate(map->fd, (off_t)(offset + size)) != 0) {
+		close(map->fd);
+		return -1;
+	}
+	if (size == 0) return 0;
+
+#ifdef __linux__
+	/* a full disk would fault on a mapped page, find out now */
+	if (posix_fallocate(map->fd, (off_t)offset, (off_t)size) == ENOSPC) {
+		close(map->fd);
+		return -1;
+	}
+#endif
+
+	/* the mapping starts on a page */
+	long page = sysconf(_SC_PAGESIZE);
+	size_t skip = page > 0 ? offset % page : 0;
+	map->length = skip + size;
+	map->base = mmap(NULL, map->length, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, (off_t)(offset - skip));
+	if (map->base != MAP_FAILED) {
+		map->data = (unsigned char *)map->base + skip;
+		return 0;
+	}
+	map->base = NULL;
+	close(map->fd);
+	map->fd = -1;
+#endif
+
+	/* no mapping: a buffer written out by gt_unmap_output */
+	map->data = (unsigned char *)malloc(size ? size : 1);
+	return map->data ? 0 : -1;
+}
+
+//---------------------------------------------------------------------------------
+int gt_unmap_output(gt_output_map *map) {
+//---------------------------------------------------------------------------------
+	int err = 0;
+
+#ifndef _WIN32
+	if (map->fd >= 0) {
+		if (map->base && munmap(map->base, map->length) != 0) err = -1;
+		if (close(map->fd) != 0) err = -1;
+		return err;
+	}
+#endif
+
+	FILE *f = fopen(map->name, map->keep ? "rb+" : "wb");
+	if (!f) f = fopen(map->name, "wb");
+	if (f) {
+		if (fseek(f, (long)map->offset, SEEK_SET) != 0) err = -1;
+		if (map->size && fwrite(map->data, 1, map->size, f) != map->size) err = -1;
+		if (fclose(f) != 0) err = -1;
+	} else {
+		err = -1;
+	}
+	free(map->data);
+	return err;
+}
+
+//---------------------------------------------------------------------------------
+int gt_printf(const gt_sink *out, const char *format, ...) {
+//---------------------------------------------------------------------------------
+	char text[1024];
+	char *p = text;
+	va_list args;
+	int len, err;
+
+	if (!out) return 0;
+
+	va_start(args, format);
+	len = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	if (len < 0) return -1;
+
+	/* long text: format again into a buffer that fits */
+	if ((size_t)len >= sizeof(text)) {
+		p = (char *)malloc(len + 1);
+		if (!p) return -1;
+		va_start(args, format);
+		vsnprintf(p, len + 1, format, args);
+		va_end(args);
+	}
+
+	err = out->write(out->context, p, len);
+	if (p != text) free(p);
+	return err;
+}
+
+//---------------------------------------------------------------------------------
+static double wall_seconds(void) {
+//---------------------------------------------------------------------------------
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	return (double)time(NULL);
+#endif
+}
+
+//---------------------------------------------------------------------------------
+static double cpu_seconds(void) {
+//---------------------------------------------------------------------------------
+#ifndef _WIN32
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+//---------------------------------------------------------------------------------
+static long peak_rss_kb(void) {
+//---------------------------------------------------------------------------------
+#ifndef _WIN32
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+	return ru.ru_maxrss / 1024;
+#else
+	return ru.ru_maxrss;
+#endif
+#else
+	return 0;
+#endif
+}
+
+//---------------------------------------------------------------------------------
+void gt_stats_init(gt_stats *stats) {
+//---------------------------------------------------------------------------------
+	if (!stats) return;
+	memset(stats, 0, sizeof(*stats));
+	stats->phase = -1;
+}
+
+//---------------------------------------------------------------------------------
+int gt_stats_phase(gt_stats *stats, int phase) {
+//---------------------------------------------------------------------------------
+	double wall, cpu;
+	int previous;
+
+	if (!stats) return -1;
+
+	previous = stats->phase;
+	if (phase == previous) return previous;
+
+	wall = wall_seconds();
+	cpu = cpu_seconds();
+	if (previous >= 0) {
+		stats->wall[previous] += wall - stats->wallMark;
+		stats->cpu[previous] += cpu - stats->cpuMark;
+	}
+
+	stats->phase = phase;
+	stats->wallMark = wall;
+	stats->cpuMark = cpu;
+	return previous;
+}
+
+//---------------------------------------------------------------------------------
+void gt_stats_add(gt_stats *stats, const gt_stats *more) {
+//---------------------------------------------------------------------------------
+	int i;
+
+	if (!stats || !more) return;
+
+	for (i = 0; i < GT_PHASES; i++) {
+		stats->wall[i] += more->wall[i];
+		stats->cpu[i] += more->cpu[i];
+	}
+	stats->bytesIn += more->bytesIn;
+	stats->bytesOut += more->bytesOut;
+	stats->opens += more->opens;
+	stats->reads += more->reads;
+	stats->writes += more->writes;
+	stats->seeks += more->seeks;
+}
+
+//---------------------------------------------------------------------------------
+static int stats_write(void *context, const void *data, size_t size) {
+//---------------------------------------------------------------------------------
+	gt_stats_sink *wrap = (gt_stats_sink *)context;
+	int previous = gt_stats_phase(wrap->stats, GT_WRITE);
+	int err = wrap->inner.write(wrap->inner.context, data, size);
+
+	wrap->stats->writes++;
+	wrap->stats->bytesOut += size;
+	gt_stats_phase(wrap->stats, previous);
+	return err;
+}
+
+//---------------------------------------------------------------------------------
+const gt_sink *gt_stats_wrap(gt_stats_sink *wrap, gt_stats *stats, const gt_sink *inner) {
+//---------------------------------------------------------------------------------
+	if (!stats || !inner) return inner;
+
+	wrap->inner = *inner;
+	wrap->stats = stats;
+	wrap->sink.write = stats_write;
+	wrap->sink.context = wrap;
+	return &wrap->sink;
+}
+
+//---------------------------------------------------------------------------------
+const char *gt_stats_option(int *argc, char **argv) {
+//---------------------------------------------------------------------------------
+	const char *destination = getenv("GT_STATS");
+	int i, j;
+
+	if (destination && (!*destination || !strcmp(destination, "0"))) destination = NULL;
+
+	for (i = j = 1; i < *argc; i++) {
+		if (!strcmp(argv[i], "--stats")) destination = "";
+		else if (!strncmp(argv[i], "--stats=", 8)) destination = argv[i] + 8;
+		else argv[j++] = argv[i];
+	}
+	*argc = j;
+	argv[j] = NULL;
+
+	return destination;
+}
+
+static const char *phase_names[GT_PHASES] = { "open", "read", "convert", "format", "write" };
+
+//---------------------------------------------------------------------------------
+int gt_stats_json(const gt_stats *stats, const char *tool, char *buf, size_t size) {
+//---------------------------------------------------------------------------------
+	double wall = 0, cpu = 0;
+	size_t len = 0;
+	int i, n;
+
+	for (i = 0; i < GT_PHASES; i++) {
+		wall += stats->wall[i];
+		cpu += stats->cpu[i];
+	}
+
+	n = snprintf(buf, size, "{\"tool\":\"%s\",\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"phases\":{", tool, wall * 1000, cpu * 1000);
+	for (i = 0; i < GT_PHASES && n >= 0; i++) {
+		len += n;
+		n = snprintf(buf + (len < size ? len : size), len < size ? size - len : 0,
+			"%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}", i ? "," : "", phase_names[i], stats->wall[i] * 1000, stats->cpu[i] * 1000);
+	}
+	if (n < 0) return n;
+	len += n;
+
+	n = snprintf(buf + (len < size ? len : size), len < size ? size - len : 0,
+		"},\"bytes_in\":%llu,\"bytes_out\":%llu,\"peak_rss_kb\":%ld,"
+		"\"opens\":%lu,\"reads\":%lu,\"writes\":%lu,\"seeks\":%lu}",
+		stats->bytesIn, stats->bytesOut, peak_rss_kb(), stats->opens, stats->reads, stats->writes, stats->seeks);
+	return n < 0 ? n : (int)(len + n);
+}
+
+//---------------------------------------------------------------------------------
+int gt_stats_report(gt_stats *stats, const char *tool, const char *destination) {
+//---------------------------------------------------------------------------------
+	char line[1024];
+	double wall = 0, cpu = 0;
+	FILE *f;
+	int i, len;
+
+	if (!stats || !destination) return 0;
+	gt_stats_phase(stats, -1);
+
+	if (*destination && strcmp(destination, "1")) {
+		/* one line per run, so runs of many processes can share a file */
+		len = gt_stats_json(stats, tool, line, sizeof(line) - 1);
+		if (len < 0 || len >= (int)sizeof(line) - 1) return -1;
+		line[len++] = '\n';
+
+		f = fopen(destination, "a");
+		if (!f) return -1;
+		setvbuf(f, NULL, _IOFBF, sizeof(line));
+		fwrite(line, 1, len, f);
+		return fclose(f);
+	}
+
+	fprintf(stderr, "%s stats:\n  %-10s %12s %12s\n", tool, "phase", "wall ms", "cpu ms");
+	for (i = 0; i < GT_PHASES; i++) {
+		fprintf(stderr, "  %-10s %12.3f %12.3f\n", phase_names[i], stats->wall[i] * 1000, stats->cpu[i] * 1000);
+		wall += stats->wall[i];
+		cpu += stats->cpu[i];
+	}
+	fprintf(stderr, "  %-10s %12.3f %12.3f\n", "total", wall * 1000, cpu * 1000);
+	fprintf(stderr, "  %llu bytes in, %llu bytes out, peak RSS %ld KB\n", stats->bytesIn, stats->bytesOut, peak_rss_kb());
+	fprintf(stderr, "  %lu opens, %lu reads, %lu writes, %lu seeks\n", stats->opens, stats->reads, stats->writes, stats->seeks);
+	return 0;
+}
+
+//---------------------------------------------------------------------------------
+static int format_data(const gt_sink *out, int style, const void *data, size_t size) {
+//---------------------------------------------------------------------------------
+	binformat *fmt = (binformat *)malloc(sizeof(binformat));
+	if (!fmt) return -1;
+
+	binformat_init(fmt, out, style, size);
+	binformat_data(fmt, data, size);
+	int err = binformat_flush(fmt);
+
+	free(fmt);
+	return err;
+}
+
+//---------------------------------------------------------------------------------
+int gt_bin2s_header_begin(const gt_sink *header) {
+//---------------------------------------------------------------------------------
+	return gt_printf(header, "%s",
+		"/* Generated by BIN2S - please don't edit directly */\n"
+		"#pragma once\n"
+		"#include <stddef.h>\n"
+		"#include <stdint.h>\n\n");
+}
+
+//---------------------------------------------------------------------------------
+int gt_bin2s(const gt_sink *out, const gt_sink *header, const char *name, const void *data, size_t size, int alignment, int apple_llvm) {
+//---------------------------------------------------------------------------------
+	char ident[256];
+	int err;
+
+	binformat_ident(name, apple_llvm, ident, sizeof(ident));
+
+	err = binformat_asm_begin(out, ident, alignment, apple_llvm);
+	err |= format_data(out, BINFORMAT_ASM, data, size);
+	err |= binformat_asm_end(out, ident, size, header == NULL);
+
+	if (header) err |= binformat_asm_header(header, binformat_ident(name, 0, ident, sizeof(ident)), size);
+
+	return err ? -1 : 0;
+}
+
+//---------------------------------------------------------------------------------
+int gt_raw2c(const gt_sink *source, const gt_sink *header, const char *name, const void *data, size_t size) {
+//---------------------------------------------------------------------------------
+	int err = binformat_c_begin(source, header, name);
+	err |= format_data(source, BINFORMAT_C, data, size);
+	err |= binformat_c_end(source, name);
+
+	return err ? -1 : 0;
+}
+
+//---------------------------------------------------------------------------------
+unsigned long gt_padding(unsigned long size, unsigned long factor) {
+//---------------------------------------------------------------------------------
+	unsigned long overage = size % factor;
+
+	return overage ? factor - overage : 0;
+}
+
+//---------------------------------------------------------------------------------
+int gt_padbin(const gt_sink *out, unsigned long size, unsigned long factor) {
+//---------------------------------------------------------------------------------
+	unsigned char fill[1024];
+	unsigned long extension = gt_padding(size, factor);
+
+	/* 0xff for faster flash writing */
+	memset(fill, 0xff, sizeof(fill));
+
+	while (extension) {
+		unsigned long len = extension < sizeof(fill) ? extension : sizeof(fill);
+		if (out->write(out->context, fill, len)) return -1;
+		extension -= len;
+	}
+
+	return 0;
+}
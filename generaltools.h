@@ -0,0 +1,180 @@
+/*---------------------------------------------------------------------------------
+
+libgeneraltools: the conversions of bin2s, raw2c, padbin and bmp2bin, in process
+
+Everything works on memory buffers and writes to sinks given by the caller,
+there is no global state, so conversions may run on several threads at once.
+The bmp2bin and server parts are C++, C programs link with the C++ runtime.
+
+---------------------------------------------------------------------------------*/
+#ifndef _generaltools_h_
+#define _generaltools_h_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*---------------------------------------------------------------------------------
+	sinks
+---------------------------------------------------------------------------------*/
+typedef struct {
+	int	(*write)(void *context, const void *data, size_t size);	/* 0 on success */
+	void	*context;
+} gt_sink;
+
+typedef struct {				/* growing memory buffer */
+	unsigned char	*data;
+	size_t		size;
+	size_t		capacity;
+} gt_buffer;
+
+void gt_file_sink(gt_sink *sink, FILE *f);
+void gt_buffer_sink(gt_sink *sink, gt_buffer *buffer);
+void gt_buffer_free(gt_buffer *buffer);
+
+/* formatted text, nothing is written to a NULL sink */
+int gt_printf(const gt_sink *out, const char *format, ...);
+
+/*---------------------------------------------------------------------------------
+	mapped output: a file of known size written in place through memory
+
+	The file is sized up front and a view of it is mapped, so writers on
+	several threads can fill disjoint parts of it without stdio or locking.
+	Where memory mapping is not available the view is a plain buffer that
+	is written to the file when it is unmapped.
+---------------------------------------------------------------------------------*/
+typedef struct {
+	unsigned char	*data;			/* size bytes of the file from offset */
+	size_t		size;
+	/* private */
+	const char	*name;
+	unsigned long long offset;
+	int		keep;
+	int		fd;
+	void		*base;
+	size_t		length;
+} gt_output_map;
+
+/* keep == 0 creates or truncates the file, otherwise the bytes before offset are kept;
+   the file ends up offset + size bytes long. name must stay valid until gt_unmap_output */
+int gt_map_output(gt_output_map *map, const char *name, unsigned long long offset, size_t size, int keep);
+int gt_unmap_output(gt_output_map *map);	/* 0 if everything was written */
+
+/*---------------------------------------------------------------------------------
+	stats: where a conversion spends its time, for --stats and GT_STATS
+
+	Wall time is per phase, cpu time is user and system time of the whole
+	process while in the phase, all threads. The counts are the I/O calls the
+	tool makes, stdio may turn them into fewer system calls.
+---------------------------------------------------------------------------------*/
+enum { GT_OPEN, GT_READ, GT_CONVERT, GT_FORMAT, GT_WRITE, GT_PHASES };
+
+typedef struct {
+	double			wall[GT_PHASES];	/* seconds */
+	double			cpu[GT_PHASES];
+	unsigned long long	bytesIn, bytesOut;
+	unsigned long		opens, reads, writes, seeks;
+	int			phase;			/* current phase, -1 if none */
+	double			wallMark, cpuMark;	/* start of the current phase */
+} gt_stats;
+
+typedef struct {				/* counts the writes to a sink as GT_WRITE */
+	gt_sink		sink;
+	gt_sink		inner;
+	gt_stats	*stats;
+} gt_stats_sink;
+
+/* every function does nothing for a NULL stats */
+void gt_stats_init(gt_stats *stats);
+int gt_stats_phase(gt_stats *stats, int phase);		/* returns the previous phase */
+const gt_sink *gt_stats_wrap(gt_stats_sink *wrap, gt_stats *stats, const gt_sink *inner);
+void gt_stats_add(gt_stats *stats, const gt_stats *more);	/* sums of jobs run side by side */
+
+/* removes --stats[=file] from the command line, returns the file, "" for stderr,
+   or GT_STATS from the environment; NULL if stats are off */
+const char *gt_stats_option(int *argc, char **argv);
+
+/* JSON object with the phases, counts and peak RSS; returns the length like snprintf */
+int gt_stats_json(const gt_stats *stats, const char *tool, char *buf, size_t size);
+
+/* text to stderr for "" or "1", otherwise a JSON line appended to the file */
+int gt_stats_report(gt_stats *stats, const char *tool, const char *destination);
+
+/*---------------------------------------------------------------------------------
+	bin2s: gcc assembly module, symbols named after the file name
+	header == NULL: the size goes into the module as name_size
+---------------------------------------------------------------------------------*/
+int gt_bin2s(const gt_sink *out, const gt_sink *header, const char *name, const void *data, size_t size, int alignment, int apple_llvm);
+int gt_bin2s_header_begin(const gt_sink *header);
+
+/*---------------------------------------------------------------------------------
+	raw2c: C array and header, name is used as is
+---------------------------------------------------------------------------------*/
+int gt_raw2c(const gt_sink *source, const gt_sink *header, const char *name, const void *data, size_t size);
+
+/*---------------------------------------------------------------------------------
+	padbin: 0xff bytes that pad size to a multiple of factor
+---------------------------------------------------------------------------------*/
+unsigned long gt_padding(unsigned long size, unsigned long factor);
+int gt_padbin(const gt_sink *out, unsigned long size, unsigned long factor);
+
+/*---------------------------------------------------------------------------------
+	bmp2bin: convert a bitmap file image
+---------------------------------------------------------------------------------*/
+typedef struct {
+	const char	*flags;			/* command line flags, e.g. "ic" for -i -c */
+	int		threads;		/* -j, 0 = one per CPU */
+	const void	*palette;		/* palette file contents for -1 */
+	size_t		paletteSize;
+	int		paletteFormat;		/* -o, 0 = GP32 text */
+	int		dither;			/* -D, 'b' Bayer, 'f' Floyd-Steinberg, 0 = none */
+	const char	*slices;		/* -s, WxH[,count[,padding]] */
+	const gt_sink	*paletteOut;		/* output palette, may be NULL */
+	const gt_sink	*map;			/* tilemap, enables tile deduplication (-k) */
+	const gt_sink	*log;			/* messages, may be NULL */
+	gt_stats	*stats;			/* may be NULL */
+} gt_bmp2bin_options;
+
+int gt_bmp2bin(const void *bitmap, size_t size, const gt_sink *out, const gt_bmp2bin_options *options);
+
+/*---------------------------------------------------------------------------------
+	server: conversion jobs as JSON lines, over stdin/stdout or a Unix socket
+
+	request:  {"id": 1, "tool": "bmp2bin", "args": ["-i", "in.bmp", "out.raw"], "cwd": "/work"}
+	response: {"id": 1, "status": 0, "ms": 1.250, "outputs": ["out.raw"],
+	           "stdout": "", "stderr": ""}
+
+	--stats in the args adds "stats", as written by gt_stats_json, to the response.
+
+	args are the command line without the program name. Jobs run on a thread
+	pool and are answered as they complete. Relative paths are taken from the
+	server's working directory, a request from another directory is refused
+	with status -1 and "refused": true, as is a request for another "tool";
+	"tool" may be a path, its file name is compared.
+---------------------------------------------------------------------------------*/
+typedef struct {
+	const char	*name;
+	/* command line to job, on the thread reading requests, one call at a time;
+	   argv stays valid until the job has run. Returns the exit status, no job to run if NULL */
+	int		(*parse)(int argc, char **argv, const gt_sink *log, void **job);
+	/* names of the files the job writes */
+	int		(*outputs)(void *job, const char **names, int max);
+	/* on a worker thread, frees the job; returns the exit status. stats may be NULL */
+	int		(*run)(void *job, const gt_sink *out, const gt_sink *log, gt_stats *stats);
+} gt_tool;
+
+/* socketPath NULL: serve stdin until it ends; threads 0: one per CPU */
+int gt_serve(const gt_tool *tool, const char *socketPath, int threads);
+
+/* runs a command line on a server; returns -1 if there is no server to ask and 1 if
+   the server refused the job, nothing is written then and the caller runs the tool itself */
+int gt_request(const char *socketPath, int argc, char **argv, const gt_sink *out, const gt_sink *log, int *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _generaltools_h_ */
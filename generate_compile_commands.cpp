@@ -0,0 +1,601 @@
+/*---------------------------------------------------------------------------------
+
+generate_compile_commands: compile_commands.json from the compile rules
+
+	generate_compile_commands add command arguments file
+	generate_compile_commands end
+
+add writes one fragment per translation unit to compile_commands.d, named after
+the file, through a temporary file and a rename: compiles running side by side
+never wait for each other and a recompiled file replaces its fragment. end reads
+the fragments on all cores and merges them into compile_commands.json, so an
+incremental build keeps the entries of the files it did not compile.
+
+---------------------------------------------------------------------------------*/
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__MSYS__)
+#include <sys/cygwin.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+static const char *fragmentDir = "compile_commands.d";
+static const char *database = "compile_commands.json";
+
+//---------------------------------------------------------------------------------
+// paths as Windows tools want them on MSYS, absolute with forward slashes
+// (cygpath -ma), unchanged elsewhere
+//---------------------------------------------------------------------------------
+static std::string nativePath(const std::string &path) {
+//---------------------------------------------------------------------------------
+#if defined(__MSYS__)
+	ssize_t size = cygwin_conv_path(CCP_POSIX_TO_WIN_A | CCP_ABSOLUTE, path.c_str(), NULL, 0);
+	if (size <= 0) return path;
+
+	std::vector<char> win(size);
+	if (cygwin_conv_path(CCP_POSIX_TO_WIN_A | CCP_ABSOLUTE, path.c_str(), &win[0], size) != 0) return path;
+
+	std::string native(&win[0]);
+	std::replace(native.begin(), native.end(), '\\', '/');
+	return native;
+#elif defined(_WIN32)
+	std::string native = path;
+
+	/* /c/dir as given by an MSYS shell */
+	if (native.size() >= 2 && native[0] == '/' && isalpha((unsigned char)native[1]) &&
+	    (native.size() == 2 || native[2] == '/'))
+		native = std::string(1, native[1]) + ":" + (native.size() == 2 ? "/" : native.substr(2));
+
+	char full[_MAX_PATH];
+	if (_fullpath(full, native.c_str(), sizeof(full))) native = full;
+	std::replace(native.begin(), native.end(), '\\', '/');
+	return native;
+#else
+	return path;
+#endif
+}
+
+#if defined(__MSYS__) || defined(_WIN32)
+//---------------------------------------------------------------------------------
+// the paths in the compiler arguments, as separate words or after the option
+//---------------------------------------------------------------------------------
+static std::string nativeArguments(const std::string &arguments) {
+//---------------------------------------------------------------------------------
+	static const char *options[] = { "-isystem", "-iquote", "-I" };
+	std::vector<std::string> words;
+	std::string translated;
+	size_t pos = 0;
+
+	while ((pos = arguments.find_first_not_of(" \t", pos)) != std::string::npos) {
+		size_t end = arguments.find_first_of(" \t", pos);
+		if (end == std::string::npos) end = arguments.size();
+		words.push_back(arguments.substr(pos, end - pos));
+		pos = end;
+	}
+
+	for (size_t i = 0; i < words.size(); i++) {
+		bool nextIsPath = false;
+
+		if (words[i].compare(0, 2, "-c") == 0) nextIsPath = true;
+
+		for (size_t o = 0; o < sizeof(options) / sizeof(options[0]); o++) {
+			size_t length = strlen(options[o]);
+			if (words[i].compare(0, length, options[o]) != 0) continue;
+			if (words[i].size() == length) nextIsPath = true;
+			else words[i] = options[o] + nativePath(words[i].substr(length));
+			break;
+		}
+
+		if (nextIsPath && i + 1 < words.size()) words[i + 1] = nativePath(words[i + 1]);
+
+		translated += " " + words[i];
+	}
+	return translated.empty() ? translated : translated.substr(1);
+}
+#endif
+
+//---------------------------------------------------------------------------------
+// the command as found on PATH, like which
+//---------------------------------------------------------------------------------
+static std::string findCommand(const std::string &name) {
+//---------------------------------------------------------------------------------
+#ifdef _WIN32
+	const char separator = ';';
+	const int mode = F_OK;
+	static const char *suffixes[] = { "", ".exe" };
+#else
+	const char separator = ':';
+	const int mode = X_OK;
+	static const char *suffixes[] = { "" };
+#endif
+	const char *path = getenv("PATH");
+
+	if (name.find('/') != std::string::npos || path == NULL) return name;
+
+	for (const char *dir = path; ; dir++) {
+		const char *end = strchr(dir, separator);
+		if (end == NULL) end = dir + strlen(dir);
+
+		std::string candidate(dir, end - dir);
+		if (candidate.empty()) candidate = ".";
+		candidate += "/" + name;
+
+		for (size_t s = 0; s < sizeof(suffixes) / sizeof(suffixes[0]); s++) {
+			struct stat st;
+			std::string file = candidate + suffixes[s];
+			if (access(file.c_str(), mode) == 0 && stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)) return file;
+		}
+
+		if (*end == 0) break;
+		dir = end;
+	}
+	return name;
+}
+
+//---------------------------------------------------------------------------------
+static std::string jsonString(const std::string &s) {
+//---------------------------------------------------------------------------------
+	std::string json = "\"";
+
+	for (size_t i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		switch (c) {
+			case '"':	json += "\\\""; break;
+			case '\\':	json += "\\\\"; break;
+			case '\b':	json += "\\b"; break;
+			case '\f':	json += "\\f"; break;
+			case '\n':	json += "\\n"; break;
+			case '\r':	json += "\\r"; break;
+			case '\t':	json += "\\t"; break;
+			default:
+				if (c < 0x20) {
+					char escape[8];
+					snprintf(escape, sizeof(escape), "\\u%04x", c);
+					json += escape;
+				} else {
+					json += (char)c;
+				}
+		}
+	}
+	return json + "\"";
+}
+
+//---------------------------------------------------------------------------------
+// FNV-1a, names the fragment of a file
+//---------------------------------------------------------------------------------
+static unsigned long long hashName(const std::string &s) {
+//---------------------------------------------------------------------------------
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < s.size(); i++) {
+		hash ^= (unsigned char)s[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+//---------------------------------------------------------------------------------
+// rename over an existing file
+//---------------------------------------------------------------------------------
+static int replaceFile(const char *from, const char *to) {
+//---------------------------------------------------------------------------------
+#if defined(_WIN32) && !defined(__MSYS__)
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+	return rename(from, to);
+#endif
+}
+
+//---------------------------------------------------------------------------------
+static bool writeFile(const std::string &name, const std::string &contents) {
+//---------------------------------------------------------------------------------
+	char temporary[64];
+	snprintf(temporary, sizeof(temporary), ".%ld.tmp", (long)getpid());
+	std::string tmpName = name + temporary;
+
+	FILE *f = fopen(tmpName.c_str(), "wb");
+	if (f == NULL) return false;
+
+	bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+	if (fclose(f) != 0) ok = false;
+
+	if (ok && replaceFile(tmpName.c_str(), name.c_str()) == 0) return true;
+	remove(tmpName.c_str());
+	return false;
+}
+
+//---------------------------------------------------------------------------------
+static bool readFile(const std::string &name, std::string &contents) {
+//---------------------------------------------------------------------------------
+	FILE *f = fopen(name.c_str(), "rb");
+	if (f == NULL) return false;
+
+	char buffer[16384];
+	size_t size;
+	contents.clear();
+	while ((size = fread(buffer, 1, sizeof(buffer), f)) > 0) contents.append(buffer, size);
+
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+//---------------------------------------------------------------------------------
+static int add(const char *command, const char *arguments, const char *file) {
+//---------------------------------------------------------------------------------
+	char cwd[4096];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		perror("generate_compile_commands: getcwd");
+		return 1;
+	}
+
+	std::string directory = nativePath(cwd);
+	std::string compiler = nativePath(findCommand(command));
+	std::string path = nativePath(file);
+#if defined(__MSYS__) || defined(_WIN32)
+	std::string args = nativeArguments(arguments);
+#else
+	std::string args = arguments;
+#endif
+
+	std::string fragment =
+		"{\n"
+		"  \"directory\": " + jsonString(directory) + ",\n"
+		"  \"command\": " + jsonString(compiler + " " + args) + ",\n"
+		"  \"file\": " + jsonString(path) + "\n"
+		"}";
+
+#ifdef _WIN32
+	mkdir(fragmentDir);
+#else
+	mkdir(fragmentDir, 0777);
+#endif
+
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx.json", hashName(directory + "\n" + path));
+
+	if (!writeFile(fragmentDir + std::string(name), fragment)) {
+		fprintf(stderr, "generate_compile_commands: could not write %s%s: %s\n", fragmentDir, name, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+//---------------------------------------------------------------------------------
+// JSON, just enough to find the file of each entry in a compilation database
+//---------------------------------------------------------------------------------
+struct Entry {
+	std::string	text;		/* the object as written */
+	std::string	key;		/* absolute path of the file */
+};
+
+//---------------------------------------------------------------------------------
+static void jsonSpace(const char *&p) {
+//---------------------------------------------------------------------------------
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+}
+
+//---------------------------------------------------------------------------------
+static void utf8(std::string &s, unsigned long c) {
+//---------------------------------------------------------------------------------
+	if (c < 0x80) {
+		s += (char)c;
+	} else if (c < 0x800) {
+		s += (char)(0xc0 | (c >> 6));
+		s += (char)(0x80 | (c & 0x3f));
+	} else if (c < 0x10000) {
+		s += (char)(0xe0 | (c >> 12));
+		s += (char)(0x80 | ((c >> 6) & 0x3f));
+		s += (char)(0x80 | (c & 0x3f));
+	} else {
+		s += (char)(0xf0 | (c >> 18));
+		s += (char)(0x80 | ((c >> 12) & 0x3f));
+		s += (char)(0x80 | ((c >> 6) & 0x3f));
+		s += (char)(0x80 | (c & 0x3f));
+	}
+}
+
+//---------------------------------------------------------------------------------
+static bool jsonHex(const char *&p, unsigned long &c) {
+//---------------------------------------------------------------------------------
+	char hex[5];
+
+	for (int i = 0; i < 4; i++) {
+		if (!isxdigit((unsigned char)p[i])) return false;
+		hex[i] = p[i];
+	}
+	hex[4] = 0;
+	c = strtoul(hex, NULL, 16);
+	p += 4;
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static bool jsonParseString(const char *&p, std::string &s) {
+//---------------------------------------------------------------------------------
+	jsonSpace(p);
+	if (*p++ != '"') return false;
+
+	s.clear();
+	while (*p != '"') {
+		if (*p == 0) return false;
+		if (*p != '\\') { s += *p++; continue; }
+
+		p++;
+		switch (*p++) {
+			case '"':	s += '"'; break;
+			case '\\':	s += '\\'; break;
+			case '/':	s += '/'; break;
+			case 'b':	s += '\b'; break;
+			case 'f':	s += '\f'; break;
+			case 'n':	s += '\n'; break;
+			case 'r':	s += '\r'; break;
+			case 't':	s += '\t'; break;
+			case 'u': {
+				unsigned long c, low;
+				if (!jsonHex(p, c)) return false;
+				/* surrogate pair */
+				if (c >= 0xd800 && c < 0xdc00 && p[0] == '\\' && p[1] == 'u') {
+					p += 2;
+					if (!jsonHex(p, low)) return false;
+					c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+				}
+				utf8(s, c);
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+	p++;
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static bool jsonSkip(const char *&p) {
+//---------------------------------------------------------------------------------
+	std::string s;
+
+	jsonSpace(p);
+	if (*p == '"') return jsonParseString(p, s);
+
+	if (*p == '[' || *p == '{') {
+		char close = *p == '[' ? ']' : '}';
+		p++;
+		jsonSpace(p);
+		if (*p == close) { p++; return true; }
+		for (;;) {
+			if (close == '}' && (!jsonParseString(p, s) || (jsonSpace(p), *p++ != ':'))) return false;
+			if (!jsonSkip(p)) return false;
+			jsonSpace(p);
+			if (*p == close) { p++; return true; }
+			if (*p++ != ',') return false;
+		}
+	}
+
+	/* number, true, false or null */
+	const char *start = p;
+	while (isalnum((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.') p++;
+	return p != start;
+}
+
+//---------------------------------------------------------------------------------
+static bool absolutePath(const std::string &path) {
+//---------------------------------------------------------------------------------
+	if (!path.empty() && (path[0] == '/' || path[0] == '\\')) return true;
+	return path.size() > 2 && isalpha((unsigned char)path[0]) && path[1] == ':' && (path[2] == '/' || path[2] == '\\');
+}
+
+//---------------------------------------------------------------------------------
+// an object of the database, keyed by its file relative to its directory
+//---------------------------------------------------------------------------------
+static bool jsonEntry(const char *&p, Entry &entry) {
+//---------------------------------------------------------------------------------
+	std::string name, directory, file;
+
+	jsonSpace(p);
+	const char *start = p;
+	if (*p++ != '{') return false;
+
+	jsonSpace(p);
+	if (*p != '}') {
+		for (;;) {
+			if (!jsonParseString(p, name)) return false;
+			jsonSpace(p);
+			if (*p++ != ':') return false;
+
+			if (name == "directory") {
+				if (!jsonParseString(p, directory)) return false;
+			} else if (name == "file") {
+				if (!jsonParseString(p, file)) return false;
+			} else if (!jsonSkip(p)) {
+				return false;
+			}
+
+			jsonSpace(p);
+			if (*p == '}') break;
+			if (*p++ != ',') return false;
+		}
+	}
+	p++;
+
+	if (file.empty()) return false;
+	entry.text.assign(start, p - start);
+	entry.key = absolutePath(file) || directory.empty() ? file : directory + "/" + file;
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static bool jsonDatabase(const std::string &json, std::vector<Entry> &entries) {
+//---------------------------------------------------------------------------------
+	const char *p = json.c_str();
+
+	jsonSpace(p);
+	if (*p++ != '[') return false;
+	jsonSpace(p);
+	if (*p == ']') return true;
+
+	for (;;) {
+		Entry entry;
+		if (!jsonEntry(p, entry)) return false;
+		entries.push_back(entry);
+
+		jsonSpace(p);
+		if (*p == ']') break;
+		if (*p++ != ',') return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+// body(i) for i < count on all cores
+//---------------------------------------------------------------------------------
+template <typename Body> static void parallelFor(size_t count, Body body) {
+//---------------------------------------------------------------------------------
+	std::atomic<size_t> next(0);
+
+	unsigned threads = std::thread::hardware_concurrency();
+	if (threads == 0) threads = 1;
+	if (threads > count) threads = count;
+
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; t++) {
+		workers.push_back(std::thread([&]() {
+			for (size_t i; (i = next++) < count; ) body(i);
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+}
+
+//---------------------------------------------------------------------------------
+// merges the fragments into the existing database: an entry for the same file
+// is replaced where it is, new files go at the end, entries for files that are
+// gone are dropped
+//---------------------------------------------------------------------------------
+static int end() {
+//---------------------------------------------------------------------------------
+	std::vector<std::string> names;
+	std::vector<Entry> entries;
+	std::string json;
+	bool haveDatabase = false;
+
+	DIR *dir = opendir(fragmentDir);
+	if (dir != NULL) {
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			size_t length = strlen(entry->d_name);
+			if (length > 5 && strcmp(entry->d_name + length - 5, ".json") == 0)
+				names.push_back(fragmentDir + std::string("/") + entry->d_name);
+		}
+		closedir(dir);
+	}
+
+	if (readFile(database, json)) {
+		haveDatabase = true;
+		if (!jsonDatabase(json, entries)) {
+			fprintf(stderr, "generate_compile_commands: %s is not a compilation database, writing it anew\n", database);
+			entries.clear();
+		}
+	}
+
+	if (dir == NULL && !haveDatabase) {
+		fprintf(stderr, "generate_compile_commands: no %s, nothing was added\n", fragmentDir);
+		return 1;
+	}
+
+	/* the same order whatever order make ran the compiles in */
+	std::sort(names.begin(), names.end());
+
+	std::vector<Entry> fragments(names.size());
+	std::vector<char> failed(names.size(), 0);
+
+	parallelFor(names.size(), [&](size_t i) {
+		std::string text;
+		const char *p = text.c_str();
+		if (!readFile(names[i], text) || (p = text.c_str(), !jsonEntry(p, fragments[i]))) failed[i] = 1;
+	});
+
+	/* one entry per file: leftovers of older runs may have left copies, the last one is kept */
+	std::map<std::string, size_t> index;
+	for (size_t i = 0; i < entries.size(); i++) index[entries[i].key] = i;
+
+	size_t kept = 0;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (index[entries[i].key] != i) continue;
+		if (kept != i) std::swap(entries[kept], entries[i]);
+		index[entries[kept].key] = kept;
+		kept++;
+	}
+	entries.resize(kept);
+
+	for (size_t i = 0; i < fragments.size(); i++) {
+		if (failed[i]) {
+			fprintf(stderr, "generate_compile_commands: could not read %s\n", names[i].c_str());
+			continue;
+		}
+		std::map<std::string, size_t>::iterator found = index.find(fragments[i].key);
+		if (found != index.end()) {
+			entries[found->second].text.swap(fragments[i].text);
+		} else {
+			index[fragments[i].key] = entries.size();
+			entries.push_back(fragments[i]);
+		}
+	}
+
+	std::vector<char> stale(entries.size(), 0);
+	parallelFor(entries.size(), [&](size_t i) {
+		struct stat st;
+		if (stat(entries[i].key.c_str(), &st) != 0 && errno == ENOENT) stale[i] = 1;
+	});
+
+	size_t size = 4;
+	for (size_t i = 0; i < entries.size(); i++) size += entries[i].text.size() + 2;
+
+	json.clear();
+	json.reserve(size);
+	json += "[\n";
+	bool first = true;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (stale[i]) continue;
+		if (!first) json += ",\n";
+		json += entries[i].text;
+		first = false;
+	}
+	json += "\n]\n";
+
+	if (!writeFile(database, json)) {
+		fprintf(stderr, "generate_compile_commands: could not write %s: %s\n", database, strerror(errno));
+		return 1;
+	}
+
+	for (size_t i = 0; i < names.size(); i++) remove(names[i].c_str());
+	rmdir(fragmentDir);
+	return 0;
+}
+
+//---------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//---------------------------------------------------------------------------------
+	if (argc == 2 && strcmp(argv[1], "end") == 0) return end();
+	if (argc >= 5 && strcmp(argv[1], "add") == 0) return add(argv[2], argv[3], argv[4]);
+
+	printf("Usage: add command arguments file\n");
+	printf("       end\n");
+	return 1;
+}
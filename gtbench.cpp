@@ -0,0 +1,650 @@
+/*---------------------------------------------------------------------------------
+
+gtbench: throughput of bin2s, raw2c, padbin and bmp2bin on synthetic inputs
+
+	gtbench [--tools dir] [--data dir] [--out bench.json] [--runs n]
+	        [--max] [--filter text] [--baseline old.json] [--threshold percent]
+
+The tools run as separate processes, the way a build runs them, and the best
+of --runs runs is kept. Inputs are generated once into the data directory and
+reused. --max adds the large cases: binaries up to 4 GB and bitmaps up to
+16384x16384, several GB of disk.
+
+Results go to a JSON file, one result per line, cases whose tool failed are
+marked "failed" and make the exit status 1. With --baseline the results are
+compared against an older file; cases that got slower than the threshold, or
+that ran before and now fail or are missing, are listed and the exit status
+is 1.
+
+---------------------------------------------------------------------------------*/
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Result {
+	std::string	name;
+	std::string	tool;
+	double		bytes;
+	double		pixels;
+	double		seconds;
+	double		rate;			/* MB/s, or Mpixel/s for bmp2bin */
+	bool		failed;			/* the tool failed, no times */
+};
+
+struct Case {
+	std::string	name;
+	const char	*tool;
+	std::vector<std::string> args;	/* after the tool */
+	const char	*stdoutFile;
+};
+
+static std::string toolDir = ".";
+static std::string dataDir = "bench-data";
+static int runs = 3;
+static bool large = false;
+static const char *filter = NULL;
+
+//---------------------------------------------------------------------------------
+// inputs
+//---------------------------------------------------------------------------------
+static uint32_t rng = 2463534242u;
+
+//---------------------------------------------------------------------------------
+static uint32_t xorshift() {
+//---------------------------------------------------------------------------------
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+//---------------------------------------------------------------------------------
+static bool exists(const std::string &path, uint64_t size) {
+//---------------------------------------------------------------------------------
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && (uint64_t)st.st_size == size;
+}
+
+//---------------------------------------------------------------------------------
+// random or compressible binary, written in chunks so 4 GB fit
+//---------------------------------------------------------------------------------
+static std::string makeBinary(const char *kind, uint64_t size, const char *label) {
+//---------------------------------------------------------------------------------
+	std::string path = dataDir + "/" + kind + "_" + label + ".bin";
+	if (exists(path, size)) return path;
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) { perror(path.c_str()); exit(1); }
+
+	std::vector<unsigned char> chunk(1 << 20);
+	bool random = !strcmp(kind, "random");
+	rng = 2463534242u;
+
+	for (uint64_t done = 0; done < size; ) {
+		size_t len = (size_t)std::min<uint64_t>(chunk.size(), size - done);
+		for (size_t i = 0; i < len; ) {
+			if (random) {
+				chunk[i++] = xorshift();
+			} else {
+				/* runs of zeros and a few small values, like tile and map data */
+				uint32_t r = xorshift();
+				size_t run = std::min<size_t>(len - i, 1 + (r & 63));
+				memset(&chunk[i], (r >> 8) % 5 ? 0 : (r >> 16) & 15, run);
+				i += run;
+			}
+		}
+		if (fwrite(&chunk[0], 1, len, f) != len) { perror(path.c_str()); exit(1); }
+		done += len;
+	}
+
+	fclose(f);
+	return path;
+}
+
+//---------------------------------------------------------------------------------
+static void put16(std::vector<unsigned char> &b, size_t pos, unsigned v) {
+//---------------------------------------------------------------------------------
+	b[pos] = v;
+	b[pos + 1] = v >> 8;
+}
+
+//---------------------------------------------------------------------------------
+static void put32(std::vector<unsigned char> &b, size_t pos, uint32_t v) {
+//---------------------------------------------------------------------------------
+	put16(b, pos, v & 0xffff);
+	put16(b, pos + 2, v >> 16);
+}
+
+//---------------------------------------------------------------------------------
+// gradient with noise and a few repeated tiles, so tile removal has work to do
+//---------------------------------------------------------------------------------
+static void pixel(int x, int y, int width, int height, unsigned char rgba[4]) {
+//---------------------------------------------------------------------------------
+	if (((x >> 3) + (y >> 3)) % 7 == 0) {
+		rgba[0] = (x & 7) * 32;
+		rgba[1] = (y & 7) * 32;
+		rgba[2] = 128;
+		rgba[3] = 255;
+		return;
+	}
+	uint32_t noise = xorshift();
+	rgba[0] = (x * 255 / width + (noise & 15)) & 0xff;
+	rgba[1] = (y * 255 / height + ((noise >> 4) & 15)) & 0xff;
+	rgba[2] = ((x + y) * 127 / (width + height) + ((noise >> 8) & 15)) & 0xff;
+	rgba[3] = (noise >> 16) & 1 ? 255 : (noise >> 24);
+}
+
+//---------------------------------------------------------------------------------
+// bitmaps: 1, 4, 8 bits and RLE8, 16 bits 555 and 565, 24 bits, 32 bits and
+// 32 bits with an alpha bit field. Rows are written one at a time.
+//---------------------------------------------------------------------------------
+static std::string makeBitmap(const char *kind, int width, int height) {
+//---------------------------------------------------------------------------------
+	char name[64];
+	snprintf(name, sizeof(name), "/%s_%dx%d.bmp", kind, width, height);
+	std::string path = dataDir + name;
+
+	int bits = atoi(kind);
+	bool rle = strstr(kind, "rle") != NULL;
+	bool alpha = strstr(kind, "alpha") != NULL;
+	bool fields = alpha || strstr(kind, "565") != NULL;
+	int colors = bits <= 8 ? 1 << bits : 0;
+	size_t header = 54 + (fields ? 16 : 0) + colors * 4;
+	uint64_t rowBytes = (((uint64_t)width * bits + 31) / 32) * 4;
+
+	/* RLE size is only known afterwards, the file is checked for its header size */
+	uint64_t size = rle ? 0 : header + rowBytes * height;
+	struct stat st;
+	if (rle ? stat(path.c_str(), &st) == 0 : exists(path, size)) return path;
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) { perror(path.c_str()); exit(1); }
+
+	std::vector<unsigned char> h(header, 0);
+	h[0] = 'B';
+	h[1] = 'M';
+	put32(h, 2, (uint32_t)std::min<uint64_t>(size, 0xffffffff));
+	put32(h, 10, header);
+	put32(h, 14, 40);
+	put32(h, 18, width);
+	put32(h, 22, height);
+	put16(h, 26, 1);
+	put16(h, 28, bits);
+	put32(h, 30, rle ? 1 : alpha ? 6 : fields ? 3 : 0);	/* RLE8, ALPHABITFIELDS, BITFIELDS */
+	put32(h, 46, colors);
+
+	if (fields && bits == 16) {
+		put32(h, 54, 0xf800);
+		put32(h, 58, 0x07e0);
+		put32(h, 62, 0x001f);
+	} else if (fields) {
+		put32(h, 54, 0x00ff0000);
+		put32(h, 58, 0x0000ff00);
+		put32(h, 62, 0x000000ff);
+		put32(h, 66, 0xff000000);
+	}
+	for (int i = 0; i < colors; i++) {
+		size_t pos = 54 + i * 4;
+		h[pos] = i * 255 / (colors - 1);
+		h[pos + 1] = (i * 37) & 0xff;
+		h[pos + 2] = 255 - h[pos];
+	}
+	fwrite(&h[0], 1, header, f);
+
+	rng = 88172645u;
+	std::vector<unsigned char> row(rowBytes + 2 * width + 2);
+	unsigned char rgba[4];
+
+	for (int y = 0; y < height; y++) {
+		size_t len = rowBytes;
+		memset(&row[0], 0, row.size());
+
+		if (rle) {
+			/* horizontal runs, encoded as count/index pairs */
+			len = 0;
+			for (int x = 0; x < width; ) {
+				int run = std::min(width - x, 1 + (int)(xorshift() & 127));
+				row[len++] = run;
+				row[len++] = ((x >> 5) + y) & 0xff;
+				x += run;
+			}
+			row[len++] = 0;
+			row[len++] = y == height - 1 ? 1 : 0;
+		} else {
+			for (int x = 0; x < width; x++) {
+				pixel(x, y, width, height, rgba);
+				unsigned index = (rgba[0] + rgba[1] + rgba[2]) / 3;
+
+				switch (bits) {
+					case 1:
+						row[x >> 3] |= (index >> 7) << (7 - (x & 7));
+						break;
+					case 4:
+						row[x >> 1] |= (index >> 4) << (x & 1 ? 0 : 4);
+						break;
+					case 8:
+						row[x] = index;
+						break;
+					case 16:
+						if (fields) put16(row, x * 2, ((rgba[0] >> 3) << 11) | ((rgba[1] >> 2) << 5) | (rgba[2] >> 3));
+						else put16(row, x * 2, ((rgba[0] >> 3) << 10) | ((rgba[1] >> 3) << 5) | (rgba[2] >> 3));
+						break;
+					case 24:
+						row[x * 3] = rgba[2];
+						row[x * 3 + 1] = rgba[1];
+						row[x * 3 + 2] = rgba[0];
+						break;
+					case 32:
+						row[x * 4] = rgba[2];
+						row[x * 4 + 1] = rgba[1];
+						row[x * 4 + 2] = rgba[0];
+						row[x * 4 + 3] = fields ? rgba[3] : 0;
+						break;
+				}
+			}
+		}
+		if (fwrite(&row[0], 1, len, f) != len) { perror(path.c_str()); exit(1); }
+	}
+
+	if (rle) {
+		long end = ftell(f);
+		fseek(f, 2, SEEK_SET);
+		put32(h, 2, end);
+		fwrite(&h[2], 1, 4, f);
+	}
+
+	fclose(f);
+	return path;
+}
+
+//---------------------------------------------------------------------------------
+// 256 color .act palette for -1
+//---------------------------------------------------------------------------------
+static std::string makePalette() {
+//---------------------------------------------------------------------------------
+	std::string path = dataDir + "/palette.act";
+	if (exists(path, 768)) return path;
+
+	unsigned char act[768];
+	for (int i = 0; i < 256; i++) {
+		act[i * 3] = (i >> 5) * 255 / 7;
+		act[i * 3 + 1] = ((i >> 2) & 7) * 255 / 7;
+		act[i * 3 + 2] = (i & 3) * 255 / 3;
+	}
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) { perror(path.c_str()); exit(1); }
+	fwrite(act, 1, sizeof(act), f);
+	fclose(f);
+	return path;
+}
+
+//---------------------------------------------------------------------------------
+// running the tools
+//---------------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------------
+static void copyFile(const std::string &from, const std::string &to) {
+//---------------------------------------------------------------------------------
+	FILE *in = fopen(from.c_str(), "rb");
+	FILE *out = fopen(to.c_str(), "wb");
+	if (!in || !out) { perror(to.c_str()); exit(1); }
+
+	std::vector<char> buffer(1 << 20);
+	size_t len;
+	while ((len = fread(&buffer[0], 1, buffer.size(), in)) > 0) fwrite(&buffer[0], 1, len, out);
+
+	fclose(in);
+	fclose(out);
+}
+
+//---------------------------------------------------------------------------------
+// one process in the data directory, stdout to a file; returns the seconds taken, < 0 on failure
+//---------------------------------------------------------------------------------
+static double runTool(const std::vector<std::string> &args, const char *stdoutFile) {
+//---------------------------------------------------------------------------------
+	std::vector<char *> argv;
+	for (size_t i = 0; i < args.size(); i++) argv.push_back((char *)args[i].c_str());
+	argv.push_back(NULL);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	pid_t pid = fork();
+	if (pid < 0) { perror("fork"); exit(1); }
+	if (pid == 0) {
+		if (chdir(dataDir.c_str()) != 0) _exit(127);
+		int out = open(stdoutFile ? stdoutFile : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		int err = open("/dev/null", O_WRONLY);
+		if (out < 0 || err < 0) _exit(127);
+		dup2(out, 1);
+		dup2(err, 2);
+		execv(argv[0], &argv[0]);
+		_exit(127);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+	return seconds;
+}
+
+//---------------------------------------------------------------------------------
+static bool wanted(const std::string &name) {
+//---------------------------------------------------------------------------------
+	return !filter || strstr(name.c_str(), filter);
+}
+
+//---------------------------------------------------------------------------------
+// best of the runs; before() restores the inputs of tools that change them
+//---------------------------------------------------------------------------------
+static void bench(std::vector<Result> &results, const Case &c, double bytes, double pixels, void (*before)() = NULL) {
+//---------------------------------------------------------------------------------
+	if (!wanted(c.name)) return;
+
+	std::vector<std::string> args(1, toolDir + "/" + c.tool);
+	args.insert(args.end(), c.args.begin(), c.args.end());
+
+	Result result;
+	result.name = c.name;
+	result.tool = c.tool;
+	result.bytes = bytes;
+	result.pixels = pixels;
+	result.seconds = 0;
+	result.rate = 0;
+	result.failed = false;
+
+	double best = -1;
+	for (int r = 0; r < runs; r++) {
+		if (before) before();
+		double seconds = runTool(args, c.stdoutFile);
+		if (seconds < 0) {
+			fprintf(stderr, "%-40s failed\n", c.name.c_str());
+			result.failed = true;
+			results.push_back(result);
+			return;
+		}
+		if (best < 0 || seconds < best) best = seconds;
+	}
+
+	result.seconds = best;
+	result.rate = (pixels ? pixels : bytes) / 1e6 / std::max(best, 1e-9);
+	results.push_back(result);
+
+	fprintf(stderr, "%-40s %10.3f ms %10.2f %s\n", c.name.c_str(), best * 1000, result.rate, pixels ? "Mpixel/s" : "MB/s");
+}
+
+//---------------------------------------------------------------------------------
+static bool anyWanted(const std::vector<Case> &cases) {
+//---------------------------------------------------------------------------------
+	for (size_t i = 0; i < cases.size(); i++) if (wanted(cases[i].name)) return true;
+	return false;
+}
+
+static std::string padbinInput, padbinWork;
+
+//---------------------------------------------------------------------------------
+static void restorePadbin() {
+//---------------------------------------------------------------------------------
+	copyFile(padbinInput, padbinWork);
+}
+
+//---------------------------------------------------------------------------------
+static void benchBinaries(std::vector<Result> &results) {
+//---------------------------------------------------------------------------------
+	static const struct { const char *label; uint64_t size; bool large; } sizes[] = {
+		{ "1K",   1ull << 10, false },
+		{ "64K",  1ull << 16, false },
+		{ "1M",   1ull << 20, false },
+		{ "16M",  1ull << 24, false },
+		{ "256M", 1ull << 28, true },
+		{ "1G",   1ull << 30, true },
+		{ "4G",   1ull << 32, true },
+	};
+	static const char *kinds[] = { "random", "compressible" };
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		if (sizes[s].large && !large) continue;
+
+		for (int k = 0; k < 2; k++) {
+			std::string label = std::string(kinds[k]) + "/" + sizes[s].label;
+			std::string input = std::string(kinds[k]) + "_" + sizes[s].label + ".bin";
+			std::vector<Case> cases = {
+				{ "bin2s/" + label,             "bin2s", { input },                   "bin2s.s" },
+				{ "bin2s/" + label + "/header", "bin2s", { "-H", "bin2s.h", input },  "bin2s.s" },
+				{ "raw2c/" + label,             "raw2c", { input },                   NULL },
+			};
+			if (!anyWanted(cases)) continue;
+
+			makeBinary(kinds[k], sizes[s].size, sizes[s].label);
+			for (size_t c = 0; c < cases.size(); c++) bench(results, cases[c], (double)sizes[s].size, 0);
+		}
+	}
+
+	/* padbin appends the padding, the rate is of the bytes written */
+	static const struct { const char *label; unsigned long factor; bool large; } factors[] = {
+		{ "64K",  1ul << 16, false },
+		{ "16M",  1ul << 24, false },
+		{ "1G",   1ul << 30, true },
+	};
+
+	padbinWork = dataDir + "/padbin.bin";
+
+	for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+		if (factors[f].large && !large) continue;
+
+		char factor[32];
+		snprintf(factor, sizeof(factor), "%lu", factors[f].factor);
+		Case c = { std::string("padbin/") + factors[f].label, "padbin", { factor, "padbin.bin" }, NULL };
+		if (!wanted(c.name)) continue;
+
+		if (padbinInput.empty()) padbinInput = makeBinary("random", 1000, "1000");
+		bench(results, c, (double)(factors[f].factor - 1000), 0, restorePadbin);
+	}
+}
+
+//---------------------------------------------------------------------------------
+static void benchBitmaps(std::vector<Result> &results) {
+//---------------------------------------------------------------------------------
+	static const char *kinds[] = { "1", "4", "8", "8rle", "16", "16_565", "24", "32", "32alpha" };
+	static const struct { int size; bool large; } sizes[] = {
+		{ 256, false }, { 2048, false }, { 8192, true }, { 16384, true },
+	};
+	/* every output mode on every depth */
+	static const char *modes[] = { "p", "q", "g", "d", "t", "e", "1" };
+	/* the rest on a paletted and a true color bitmap */
+	static const struct { const char *label; const char *flags; const char *param; const char *output; bool indexed; } extras[] = {
+		{ "i",   "-i",  NULL,      "out.raw", true },
+		{ "n",   "-n",  NULL,      "out.raw", true },
+		{ "r",   "-r",  NULL,      "out.raw", false },
+		{ "c",   "-c",  NULL,      "out.raw", false },
+		{ "k",   "-ck", "out.map", "out.raw", false },
+		{ "x",   "-x",  NULL,      "out.raw", false },
+		{ "j0",  "-j",  "0",       "out.raw", false },
+		{ "s",   "-p",  NULL,      "out.s",   false },
+		{ "cc",  "-p",  NULL,      "out.c",   false },
+	};
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		if (sizes[s].large && !large) continue;
+		int size = sizes[s].size;
+
+		for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+			char prefix[64], input[64];
+			snprintf(prefix, sizeof(prefix), "bmp2bin/%s/%dx%d/", kinds[k], size, size);
+			snprintf(input, sizeof(input), "%s_%dx%d.bmp", kinds[k], size, size);
+
+			std::vector<Case> cases;
+			for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+				Case c = { prefix + std::string(modes[m]), "bmp2bin", { std::string("-") + modes[m] }, NULL };
+				if (!strcmp(modes[m], "1")) c.args.push_back("palette.act");
+				c.args.push_back(input);
+				c.args.push_back("out.raw");
+				cases.push_back(c);
+			}
+
+			if (!strcmp(kinds[k], "8") || !strcmp(kinds[k], "24")) {
+				for (size_t e = 0; e < sizeof(extras) / sizeof(extras[0]); e++) {
+					if (extras[e].indexed && atoi(kinds[k]) > 8) continue;
+					/* the tilemap holds 1024 tiles, enough for 256x256 */
+					if (!strcmp(extras[e].label, "k") && size > 256) continue;
+
+					Case c = { std::string(prefix) + extras[e].label, "bmp2bin", { extras[e].flags }, NULL };
+					if (extras[e].param) c.args.push_back(extras[e].param);
+					c.args.push_back(input);
+					c.args.push_back(extras[e].output);
+					cases.push_back(c);
+				}
+			}
+			if (!anyWanted(cases)) continue;
+
+			makePalette();
+			makeBitmap(kinds[k], size, size);
+			for (size_t c = 0; c < cases.size(); c++) bench(results, cases[c], 0, (double)size * size);
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------
+// results
+//---------------------------------------------------------------------------------
+static bool writeResults(const char *path, const std::vector<Result> &results) {
+//---------------------------------------------------------------------------------
+	FILE *f = fopen(path, "w");
+	if (!f) { perror(path); return false; }
+
+	fprintf(f, "{\n\t\"package\": \"%s\",\n\t\"runs\": %d,\n\t\"results\": [\n", PACKAGE_STRING, runs);
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		fprintf(f, "\t\t{\"name\": \"%s\", \"tool\": \"%s\", \"bytes\": %.0f, \"pixels\": %.0f, \"seconds\": %.6f, \"rate\": %.3f, \"unit\": \"%s\"%s}%s\n",
+			r.name.c_str(), r.tool.c_str(), r.bytes, r.pixels, r.seconds, r.rate,
+			r.pixels ? "Mpixel/s" : "MB/s", r.failed ? ", \"failed\": true" : "", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+
+	return fclose(f) == 0;
+}
+
+//---------------------------------------------------------------------------------
+// name and rate of each result line of a file written by writeResults, 0 if it failed
+//---------------------------------------------------------------------------------
+static bool readResults(const char *path, std::map<std::string, double> &rates) {
+//---------------------------------------------------------------------------------
+	FILE *f = fopen(path, "r");
+	if (!f) { perror(path); return false; }
+
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		const char *name = strstr(line, "\"name\": \"");
+		const char *rate = strstr(line, "\"rate\": ");
+		if (!name || !rate) continue;
+
+		name += 9;
+		const char *end = strchr(name, '"');
+		if (!end) continue;
+		rates[std::string(name, end - name)] = strstr(line, "\"failed\": true") ? 0 : strtod(rate + 8, NULL);
+	}
+
+	fclose(f);
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static int compare(const char *baseline, const std::vector<Result> &results, double threshold) {
+//---------------------------------------------------------------------------------
+	std::map<std::string, double> rates;
+	if (!readResults(baseline, rates)) return 1;
+
+	int slower = 0, broken = 0;
+	fprintf(stderr, "\n%-40s %12s %12s %8s\n", "case", "baseline", "current", "change");
+	for (size_t i = 0; i < results.size(); i++) {
+		std::map<std::string, double>::iterator old = rates.find(results[i].name);
+		if (old == rates.end() || old->second <= 0) continue;
+
+		if (results[i].failed) {
+			fprintf(stderr, "%-40s %12.2f %12s %8s  FAILED\n", results[i].name.c_str(), old->second, "-", "");
+			broken++;
+			continue;
+		}
+
+		double change = (results[i].rate / old->second - 1) * 100;
+		bool regressed = change < -threshold;
+		if (regressed) slower++;
+
+		fprintf(stderr, "%-40s %12.2f %12.2f %+7.1f%%%s\n", results[i].name.c_str(), old->second, results[i].rate, change, regressed ? "  SLOWER" : "");
+	}
+
+	/* cases of the baseline that did not run at all, unless --filter left them out */
+	std::map<std::string, bool> current;
+	for (size_t i = 0; i < results.size(); i++) current[results[i].name] = true;
+	for (std::map<std::string, double>::iterator old = rates.begin(); old != rates.end(); ++old) {
+		if (old->second <= 0 || current.count(old->first) || !wanted(old->first)) continue;
+		fprintf(stderr, "%-40s %12.2f %12s %8s  MISSING\n", old->first.c_str(), old->second, "-", "");
+		broken++;
+	}
+
+	fprintf(stderr, "\n%d of %d cases more than %.0f%% slower than %s, %d failed or missing\n", slower, (int)results.size(), threshold, baseline, broken);
+	return slower || broken ? 1 : 0;
+}
+
+//---------------------------------------------------------------------------------
+static void usage() {
+//---------------------------------------------------------------------------------
+	fprintf(stderr, "usage: gtbench [--tools dir] [--data dir] [--out bench.json] [--runs n]\n"
+			"               [--max] [--filter text] [--baseline old.json] [--threshold percent]\n");
+}
+
+//---------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//---------------------------------------------------------------------------------
+	const char *out = "bench.json";
+	const char *baseline = NULL;
+	double threshold = 10;
+
+	for (int a = 1; a < argc; a++) {
+		bool more = a + 1 < argc;
+		if (!strcmp(argv[a], "--tools") && more) toolDir = argv[++a];
+		else if (!strcmp(argv[a], "--data") && more) dataDir = argv[++a];
+		else if (!strcmp(argv[a], "--out") && more) out = argv[++a];
+		else if (!strcmp(argv[a], "--runs") && more) runs = std::max(1, atoi(argv[++a]));
+		else if (!strcmp(argv[a], "--filter") && more) filter = argv[++a];
+		else if (!strcmp(argv[a], "--baseline") && more) baseline = argv[++a];
+		else if (!strcmp(argv[a], "--threshold") && more) threshold = atof(argv[++a]);
+		else if (!strcmp(argv[a], "--max")) large = true;
+		else { usage(); return 1; }
+	}
+
+	/* the tools run in the data directory */
+	char resolved[PATH_MAX];
+	if (!realpath(toolDir.c_str(), resolved)) { perror(toolDir.c_str()); return 1; }
+	toolDir = resolved;
+	mkdir(dataDir.c_str(), 0755);
+
+	std::vector<Result> results;
+	benchBinaries(results);
+	benchBitmaps(results);
+
+	if (!writeResults(out, results)) return 1;
+	fprintf(stderr, "%d results written to %s\n", (int)results.size(), out);
+
+	int failed = 0;
+	for (size_t i = 0; i < results.size(); i++) if (results[i].failed) failed++;
+	if (failed) fprintf(stderr, "%d cases failed\n", failed);
+
+	int status = baseline ? compare(baseline, results, threshold) : 0;
+	return failed ? 1 : status;
+}
@@ -0,0 +1,37 @@
+/*---------------------------------------------------------------------------------
+
+gtclient: run a bin2s, raw2c, padbin or bmp2bin command line on a server started
+with --serve, or run the tool itself when there is no server or the server can't
+take the job, e.g. because it runs in another directory
+
+	gtclient /tmp/bmp2bin.sock bmp2bin -i in.bmp out.raw
+
+---------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "generaltools.h"
+
+//---------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//---------------------------------------------------------------------------------
+	gt_sink out, log;
+	int status;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s socket tool [arguments ...]\n", argv[0]);
+		return 1;
+	}
+
+	gt_file_sink(&out, stdout);
+	gt_file_sink(&log, stderr);
+
+	if (gt_request(argv[1], argc - 2, argv + 2, &out, &log, &status) == 0) return status;
+
+	execvp(argv[2], argv + 2);
+	fprintf(stderr, "%s: could not run %s\n", argv[0], argv[2]);
+	perror(argv[2]);
+	return 127;
+}
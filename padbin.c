@@ -37,61 +37,136 @@ Visit http://www.pineight.com/ for more information.
 	"$Header: /lvm/shared/ds/ds/cvs/devkitpro-cvsbackup/tools/general/padbin.c,v 1.2 2005-06-15 16:25:12 wntrmute Exp $"
 */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-char zeroz[1024];
+#include "generaltools.h"
 
-int main(int argc, char **argv)
+typedef struct
 {
-  FILE *fp;
-  unsigned long overage;
+  unsigned long factor;
+  char *name;
+} padbin_job;
+
+static int parse(int argc, char **argv, const gt_sink *log, void **job)
+{
+  padbin_job *p;
   unsigned long factor;
 
-  /* clear to 0xff for faster flash writing */
-  for(factor = 0; factor < 1024; factor++)
-    zeroz[factor] = 0xff;
+  *job = NULL;
 
   if(argc != 3)
   {
-    fputs("pads a binary file to an integer multiple of a given number of bytes\n"
+    gt_printf(log, "%s",
+          "pads a binary file to an integer multiple of a given number of bytes\n"
           "syntax: padbin FACTOR FILE\n"
-          "FACTOR can be decimal (e.g. 256), octal (e.g. 0400), or hex (e.g. 0x100)\n", stderr);
+          "        padbin --serve [socket]\n"
+          "        --stats[=file] time spent per phase, to stderr or appended to file\n"
+          "FACTOR can be decimal (e.g. 256), octal (e.g. 0400), or hex (e.g. 0x100)\n");
     return 1;
   }
 
   factor = strtoul(argv[1], NULL, 0);
   if(factor < 2)
   {
-    fputs("error: FACTOR must be greater than or equal to 2\n", stderr);
+    gt_printf(log, "error: FACTOR must be greater than or equal to 2\n");
     return 1;
   }
 
-  fp = fopen(argv[2], "rb+");
+  p = (padbin_job *)malloc(sizeof(padbin_job));
+  if(!p)
+    return 1;
+  p->factor = factor;
+  p->name = argv[2];
+  *job = p;
+  return 0;
+}
+
+static int outputs(void *job, const char **names, int max)
+{
+  if(max < 1)
+    return 0;
+  names[0] = ((padbin_job *)job)->name;
+  return 1;
+}
+
+static int run(void *job, const gt_sink *out, const gt_sink *log, gt_stats *stats)
+{
+  padbin_job *p = (padbin_job *)job;
+  FILE *fp;
+  unsigned long size, padding;
+  gt_output_map map;
+  int status = 0;
+
+  gt_stats_phase(stats, GT_OPEN);
+  if(stats)
+  {
+    stats->opens += 2;
+    stats->seeks++;
+  }
+  fp = fopen(p->name, "rb");
   if(!fp)
   {
-    fputs("could not open", stderr);
-    perror(argv[2]);
+    gt_printf(log, "could not open%s: %s\n", p->name, strerror(errno));
+    free(p);
     return 1;
   }
-
-  /* find the amount the file has over the limit */
   fseek(fp, 0, SEEK_END);
-  overage = ftell(fp) % factor;
-  if(overage != 0)
-  {
-    unsigned long extension = factor - overage;
+  size = ftell(fp);
+  fclose(fp);
 
-    while(extension >= 1024)
+  /* the file is extended to its final size and the padding written in place,
+     0xff for faster flash writing */
+  padding = gt_padding(size, p->factor);
+  if(padding)
+  {
+    if(gt_map_output(&map, p->name, size, padding, 1) != 0)
     {
-      fwrite(zeroz, 1, 1024, fp);
-      extension -= 1024;
+      gt_printf(log, "could not open%s: %s\n", p->name, strerror(errno));
+      free(p);
+      return 1;
     }
-    if(extension >= 0)
+    gt_stats_phase(stats, GT_FORMAT);
+    memset(map.data, 0xff, padding);
+    gt_stats_phase(stats, GT_WRITE);
+    if(stats)
+      stats->bytesOut += padding;
+    if(gt_unmap_output(&map) != 0)
     {
-      fwrite(zeroz, 1, extension, fp);
+      gt_printf(log, "could not write %s: %s\n", p->name, strerror(errno));
+      status = 1;
     }
   }
-  fclose(fp);
-  return 0;
+  free(p);
+  return status;
+}
+
+static const gt_tool tool = { "padbin", parse, outputs, run };
+
+int main(int argc, char **argv)
+{
+  gt_sink out, log;
+  gt_stats stats;
+  const char *stats_to;
+  void *job;
+  int status;
+
+  if(argc > 1 && !strcmp(argv[1], "--serve"))
+    return gt_serve(&tool, argc > 2 ? argv[2] : NULL, 0);
+
+  stats_to = gt_stats_option(&argc, argv);
+  gt_stats_init(&stats);
+
+  gt_file_sink(&out, stdout);
+  gt_file_sink(&log, stderr);
+
+  status = parse(argc, argv, &log, &job);
+  if(!job)
+    return status;
+
+  status = run(job, &out, &log, stats_to ? &stats : NULL);
+  gt_stats_report(&stats, "padbin", stats_to);
+  return status;
 }
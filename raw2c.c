@@ -1,186 +1,267 @@
-/*---------------------------------------------------------------------------------
-
-
-  - WinterMute <wntrmute@gmail.com>
-  http://www.devkitpro.org
----------------------------------------------------------------------------------*/
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
+/*---------------------------------------------------------------------------------
+
+
+  - WinterMute <wntrmute@gmail.com>
+  http://www.devkitpro.org
+---------------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sys/param.h>
-
-
-char	srcName[MAXPATHLEN], dstName[MAXPATHLEN];	// file name buffers
-static char	baseFileName[MAXPATHLEN];		// source file name without extension
-static char	ArrayName[MAXPATHLEN];		// source file name without extension
-
-//---------------------------------------------------------------------------------
-// Parse file name. Put file name without extension in
-// baseFileName, and return:
-//---------------------------------------------------------------------------------
-void parseFileName(char *str) {
-//---------------------------------------------------------------------------------
-	int	i;
-	char	*cptr;
-
-
-	strcpy(baseFileName, str);
-	strcpy(srcName, str);
-
-
-	cptr = strrchr(str, '.');
-	if (!cptr) {						// if '.' not found, then append default extension
-		strcat(srcName, ".bin");
-	}
-	else {
-		i = (int) (cptr - str);	// get offset of '.' character
-		baseFileName[i] = '\0';
-	}
-
-	if ((cptr = strrchr(baseFileName,'\\'))) {
-		strcpy(ArrayName, cptr+1);
-	} else if ((cptr = strrchr(baseFileName, '/'))) {
-		strcpy(ArrayName, cptr+1);
-	} else {
-		strcpy(ArrayName, baseFileName);
-	}
-
-}
-
-//---------------------------------------------------------------------------------
-long fsize(FILE* f) {
-//---------------------------------------------------------------------------------
-	long size;
-	long temp = ftell(f);
-
-	fseek(f,0,SEEK_END);
-
-	size = ftell(f);
-
-	fseek(f, temp, SEEK_SET);
-
-	return size;
-}
-
-
-static const char head[] = "/*\n  This file was autogenerated by raw2c.\nVisit http://www.devkitpro.org\n*/\n\n";
-static const char comment[] = "//---------------------------------------------------------------------------------\n";
-
-void Help() {}
-
-//---------------------------------------------------------------------------------
-void usage () {
-//---------------------------------------------------------------------------------
-	fprintf(stderr,	"Usage:\traw2c filename<ext>\n"
-					"\tConverts a binary file to C array and header\n"
-					"\tdefault input extension is .bin\n");
-}
-
-//---------------------------------------------------------------------------------
-static void MakeSource(FILE* Infile, FILE* Outfile, FILE *Headerfile, int size) {
-//---------------------------------------------------------------------------------
-
-	unsigned long int counter = 0UL;
-	unsigned long int length;
-	unsigned char thisElement;
-	rewind(Infile);
-	rewind(Outfile);
-	length = fsize(Infile);
-
-	fprintf(Headerfile, head); /* Put top comment into source */
-	fprintf(Headerfile, comment); /* Put separator comment into source */
-	fprintf(Headerfile, "#ifndef _%s_h_\n",ArrayName);
-	fprintf(Headerfile, "#define _%s_h_\n",ArrayName);
-	fprintf(Headerfile, comment); /* Put separator comment into source */
-	fprintf(Headerfile, "extern const unsigned char %s[];\n",ArrayName);
-	fprintf(Headerfile, "extern const int %s_size;\n",ArrayName);
-	fprintf(Headerfile, comment); /* Put separator comment into source */
-	fprintf(Headerfile, "#endif //_%s_h_\n",ArrayName);
-	fprintf(Headerfile, comment); /* Put separator comment into source */
-
-	fprintf(Outfile, head); /* Put top comment into source */
-	fprintf(Outfile, "const unsigned char %s[] = {\n\t", ArrayName);
-
-	while ( counter < length ) {
-
-
-		if ( fread(&thisElement, 1, 1, Infile) >= 1 ) {
-			fprintf(Outfile,"0x%02x", thisElement);
-		}
-
-		counter++;
-		if ( counter < length ) /* More to go */
- 		fprintf(Outfile, ", ");
-
-		if ( !((counter) % 16) ) {
-			fputc('\n', Outfile);
-			fputc('\t', Outfile);
-		}
-
-	}
-
-	fprintf(Outfile, "\n};\n");
-	fprintf(Outfile,"const int %s_size = sizeof(%s);\n",ArrayName,ArrayName);
-	return;
-}
-
-//---------------------------------------------------------------------------------
-int main (int argc, char* argv[]) {
-//---------------------------------------------------------------------------------
-	int elementSize;
-	int a;
-
-	FILE *fInfile, *fCfile, *fHfile;
-
-	fprintf(stderr,"Raw2C by WinterMute\n");
-	if (argc < 2) {
-		usage();
-		return -1;
-	}
-	for (a=1; a<argc; a++) {
-
-		if (argv[a][0] == '-')
-		{
-			switch (argv[a][1])
-			{
-				case 'h':
-					Help();
-					break;
-				case 's':
-					elementSize = atoi(&argv[a][2]);
-					break;
-				default:
-				{
-					printf("Unknown option: %s\n", argv[a]);
-					Help();
-					break;
-				}
-			}
-		} else {
-			parseFileName(argv[a]);
-		}
-	}
-
-	fInfile = fopen(srcName, "rb");
-
-	strcpy(dstName, ArrayName);
-	strcat(dstName, ".c");
-	fCfile = fopen(dstName, "wb");
-
-	strcpy(dstName, ArrayName);
-	strcat(dstName, ".h");
-	fHfile = fopen(dstName, "wb");
-
-	MakeSource(fInfile,fCfile,fHfile,1);
-
-	fclose(fInfile);
-	fclose(fCfile);
-	fclose(fHfile);
-
-
-	return EXIT_SUCCESS;
-}
-
-
+
+#include "generaltools.h"
+#include "binformat.h"
+
+
+typedef struct {
+	char	srcName[MAXPATHLEN];		// file name buffers
+	char	baseFileName[MAXPATHLEN];	// source file name without extension
+	char	ArrayName[MAXPATHLEN];		// source file name without extension or path
+	char	cName[MAXPATHLEN];
+	char	hName[MAXPATHLEN];
+} raw2c_job;
+
+//---------------------------------------------------------------------------------
+// Parse file name. Put file name without extension in
+// baseFileName, and return:
+//---------------------------------------------------------------------------------
+void parseFileName(raw2c_job *job, char *str) {
+//---------------------------------------------------------------------------------
+	int	i;
+	char	*cptr;
+
+
+	strcpy(job->baseFileName, str);
+	strcpy(job->srcName, str);
+
+
+	cptr = strrchr(str, '.');
+	if (!cptr) {						// if '.' not found, then append default extension
+		strcat(job->srcName, ".bin");
+	}
+	else {
+		i = (int) (cptr - str);	// get offset of '.' character
+		job->baseFileName[i] = '\0';
+	}
+
+	if ((cptr = strrchr(job->baseFileName,'\\'))) {
+		strcpy(job->ArrayName, cptr+1);
+	} else if ((cptr = strrchr(job->baseFileName, '/'))) {
+		strcpy(job->ArrayName, cptr+1);
+	} else {
+		strcpy(job->ArrayName, job->baseFileName);
+	}
+
+}
+
+//---------------------------------------------------------------------------------
+long fsize(FILE* f) {
+//---------------------------------------------------------------------------------
+	long size;
+	long temp = ftell(f);
+
+	fseek(f,0,SEEK_END);
+
+	size = ftell(f);
+
+	fseek(f, temp, SEEK_SET);
+
+	return size;
+}
+
+
+void Help() {}
+
+//---------------------------------------------------------------------------------
+void usage (const gt_sink *log) {
+//---------------------------------------------------------------------------------
+	gt_printf(log,	"Usage:\traw2c filename<ext>\n"
+					"\traw2c --serve [socket]\n"
+					"\t--stats[=file] time spent per phase, to stderr or appended to file\n"
+					"\tConverts a binary file to C array and header\n"
+					"\tdefault input extension is .bin\n");
+}
+
+//---------------------------------------------------------------------------------
+static void MakeSource(raw2c_job *job, FILE* Infile, FILE* Outfile, FILE *Headerfile, int size, gt_stats *stats) {
+//---------------------------------------------------------------------------------
+
+	unsigned char *buffer = (unsigned char *)malloc(BINFORMAT_BUFSIZE);
+	binformat *fmt = (binformat *)malloc(sizeof(binformat));
+	gt_sink source_file, header_file;
+	gt_stats_sink source_stats, header_stats;
+	const gt_sink *source, *header;
+	unsigned long int counter = 0UL;
+	unsigned long int length;
+	rewind(Infile);
+	rewind(Outfile);
+	length = fsize(Infile);
+
+	gt_file_sink(&source_file, Outfile);
+	gt_file_sink(&header_file, Headerfile);
+	source = gt_stats_wrap(&source_stats, stats, &source_file);
+	header = gt_stats_wrap(&header_stats, stats, &header_file);
+
+	gt_stats_phase(stats, GT_FORMAT);
+	binformat_c_begin(source, header, job->ArrayName);
+
+	binformat_init(fmt, source, BINFORMAT_C, length);
+
+	while ( counter < length ) {
+
+		gt_stats_phase(stats, GT_READ);
+		size_t len = fread(buffer, 1, MIN(length - counter, BINFORMAT_BUFSIZE), Infile);
+		if (stats) {
+			stats->reads++;
+			stats->bytesIn += len;
+		}
+		if ( len == 0 ) break;
+
+		gt_stats_phase(stats, GT_FORMAT);
+		binformat_data(fmt, buffer, len);
+		counter += len;
+	}
+	gt_stats_phase(stats, GT_FORMAT);
+	binformat_flush(fmt);
+
+	binformat_c_end(source, job->ArrayName);
+
+	free(fmt);
+	free(buffer);
+	return;
+}
+
+//---------------------------------------------------------------------------------
+static int parse(int argc, char **argv, const gt_sink *log, void **job) {
+//---------------------------------------------------------------------------------
+	raw2c_job *r;
+	int elementSize;
+	int a;
+
+	*job = NULL;
+
+	if (argc < 2) {
+		usage(log);
+		return -1;
+	}
+
+	r = (raw2c_job *)calloc(1, sizeof(raw2c_job));
+	if (!r) return -1;
+
+	for (a=1; a<argc; a++) {
+
+		if (argv[a][0] == '-')
+		{
+			switch (argv[a][1])
+			{
+				case 'h':
+					Help();
+					break;
+				case 's':
+					elementSize = atoi(&argv[a][2]);
+					break;
+				default:
+				{
+					gt_printf(log, "Unknown option: %s\n", argv[a]);
+					Help();
+					break;
+				}
+			}
+		} else {
+			parseFileName(r, argv[a]);
+		}
+	}
+
+	strcpy(r->cName, r->ArrayName);
+	strcat(r->cName, ".c");
+
+	strcpy(r->hName, r->ArrayName);
+	strcat(r->hName, ".h");
+
+	*job = r;
+	return 0;
+}
+
+//---------------------------------------------------------------------------------
+static int outputs(void *job, const char **names, int max) {
+//---------------------------------------------------------------------------------
+	raw2c_job *r = (raw2c_job *)job;
+
+	if (max < 2) return 0;
+	names[0] = r->cName;
+	names[1] = r->hName;
+	return 2;
+}
+
+//---------------------------------------------------------------------------------
+static int run(void *job, const gt_sink *out, const gt_sink *log, gt_stats *stats) {
+//---------------------------------------------------------------------------------
+	raw2c_job *r = (raw2c_job *)job;
+	FILE *fInfile, *fCfile, *fHfile;
+
+	gt_stats_phase(stats, GT_OPEN);
+	if (stats) {
+		stats->opens += 3;
+		stats->seeks += 4;
+	}
+	fInfile = fopen(r->srcName, "rb");
+	if (!fInfile) {
+		gt_printf(log, "raw2c: could not open %s: %s\n", r->srcName, strerror(errno));
+		free(r);
+		return EXIT_FAILURE;
+	}
+
+	fCfile = fopen(r->cName, "wb");
+	fHfile = fopen(r->hName, "wb");
+	if (!fCfile || !fHfile) {
+		gt_printf(log, "raw2c: could not create %s: %s\n", fCfile ? r->hName : r->cName, strerror(errno));
+		if (fCfile) fclose(fCfile);
+		if (fHfile) fclose(fHfile);
+		fclose(fInfile);
+		free(r);
+		return EXIT_FAILURE;
+	}
+
+	MakeSource(r, fInfile,fCfile,fHfile,1,stats);
+
+	/* closing flushes the last of the output */
+	gt_stats_phase(stats, GT_WRITE);
+	fclose(fInfile);
+	fclose(fCfile);
+	fclose(fHfile);
+
+	free(r);
+	return EXIT_SUCCESS;
+}
+
+static const gt_tool tool = { "raw2c", parse, outputs, run };
+
+//---------------------------------------------------------------------------------
+int main (int argc, char* argv[]) {
+//---------------------------------------------------------------------------------
+	gt_sink out, log;
+	gt_stats stats;
+	const char *stats_to;
+	void *job;
+	int status;
+
+	if (argc > 1 && !strcmp(argv[1], "--serve")) return gt_serve(&tool, argc > 2 ? argv[2] : NULL, 0);
+
+	fprintf(stderr,"Raw2C by WinterMute\n");
+
+	stats_to = gt_stats_option(&argc, argv);
+	gt_stats_init(&stats);
+
+	gt_file_sink(&out, stdout);
+	gt_file_sink(&log, stderr);
+
+	status = parse(argc, argv, &log, &job);
+	if (!job) return status;
+
+	status = run(job, &out, &log, stats_to ? &stats : NULL);
+	gt_stats_report(&stats, "raw2c", stats_to);
+	return status;
+}
@@ -0,0 +1,602 @@
+/*---------------------------------------------------------------------------------
+
+libgeneraltools: conversion server, JSON lines over stdin/stdout or a Unix socket
+
+---------------------------------------------------------------------------------*/
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "generaltools.h"
+
+//---------------------------------------------------------------------------------
+// JSON, just enough for the requests and responses
+//---------------------------------------------------------------------------------
+typedef std::function<bool(const std::string &key, const char *&p)> JsonMember;
+
+//---------------------------------------------------------------------------------
+static void jsonSpace(const char *&p) {
+//---------------------------------------------------------------------------------
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+}
+
+//---------------------------------------------------------------------------------
+static void utf8(std::string &s, unsigned long c) {
+//---------------------------------------------------------------------------------
+	if (c < 0x80) {
+		s += (char)c;
+	} else if (c < 0x800) {
+		s += (char)(0xc0 | (c >> 6));
+		s += (char)(0x80 | (c & 0x3f));
+	} else if (c < 0x10000) {
+		s += (char)(0xe0 | (c >> 12));
+		s += (char)(0x80 | ((c >> 6) & 0x3f));
+		s += (char)(0x80 | (c & 0x3f));
+	} else {
+		s += (char)(0xf0 | (c >> 18));
+		s += (char)(0x80 | ((c >> 12) & 0x3f));
+		s += (char)(0x80 | ((c >> 6) & 0x3f));
+		s += (char)(0x80 | (c & 0x3f));
+	}
+}
+
+//---------------------------------------------------------------------------------
+static bool jsonHex(const char *&p, unsigned long &c) {
+//---------------------------------------------------------------------------------
+	char hex[5];
+
+	for (int i = 0; i < 4; i++) {
+		if (!isxdigit((unsigned char)p[i])) return false;
+		hex[i] = p[i];
+	}
+	hex[4] = 0;
+	c = strtoul(hex, NULL, 16);
+	p += 4;
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+static bool jsonString(const char *&p, std::string &s) {
+//---------------------------------------------------------------------------------
+	jsonSpace(p);
+	if (*p++ != '"') return false;
+
+	s.clear();
+	while (*p != '"') {
+		if (*p == 0) return false;
+		if (*p != '\\') { s += *p++; continue; }
+
+		p++;
+		switch (*p++) {
+			case '"':	s += '"'; break;
+			case '\\':	s += '\\'; break;
+			case '/':	s += '/'; break;
+			case 'b':	s += '\b'; break;
+			case 'f':	s += '\f'; break;
+			case 'n':	s += '\n'; break;
+			case 'r':	s += '\r'; break;
+			case 't':	s += '\t'; break;
+			case 'u': {
+				unsigned long c, low;
+				if (!jsonHex(p, c)) return false;
+				/* surrogate pair */
+				if (c >= 0xd800 && c < 0xdc00 && p[0] == '\\' && p[1] == 'u') {
+					p += 2;
+					if (!jsonHex(p, low)) return false;
+					c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+				}
+				utf8(s, c);
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+	p++;
+	return true;
+}
+
+static bool jsonValue(const char *&p);
+
+//---------------------------------------------------------------------------------
+static bool jsonObject(const char *&p, const JsonMember &member) {
+//---------------------------------------------------------------------------------
+	std::string key;
+
+	jsonSpace(p);
+	if (*p++ != '{') return false;
+	jsonSpace(p);
+	if (*p == '}') { p++; return true; }
+
+	while (1) {
+		if (!jsonString(p, key)) return false;
+		jsonSpace(p);
+		if (*p++ != ':') return false;
+		jsonSpace(p);
+		if (!(member ? member(key, p) : jsonValue(p))) return false;
+		jsonSpace(p);
+		if (*p == '}') { p++; return true; }
+		if (*p++ != ',') return false;
+	}
+}
+
+//---------------------------------------------------------------------------------
+static bool jsonArray(const char *&p, const std::function<bool(const char *&p)> &element) {
+//---------------------------------------------------------------------------------
+	jsonSpace(p);
+	if (*p++ != '[') return false;
+	jsonSpace(p);
+	if (*p == ']') { p++; return true; }
+
+	while (1) {
+		jsonSpace(p);
+		if (!element(p)) return false;
+		jsonSpace(p);
+		if (*p == ']') { p++; return true; }
+		if (*p++ != ',') return false;
+	}
+}
+
+//---------------------------------------------------------------------------------
+// skip any value
+//---------------------------------------------------------------------------------
+static bool jsonValue(const char *&p) {
+//---------------------------------------------------------------------------------
+	std::string s;
+
+	jsonSpace(p);
+	switch (*p) {
+		case '"':	return jsonString(p, s);
+		case '{':	return jsonObject(p, JsonMember());
+		case '[':	return jsonArray(p, jsonValue);
+	}
+
+	const char *start = p;
+	while (*p && !strchr(" \t\r\n,]}", *p)) p++;
+	return p != start;
+}
+
+//---------------------------------------------------------------------------------
+static void jsonQuote(std::string &out, const char *s, size_t len) {
+//---------------------------------------------------------------------------------
+	out += '"';
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = s[i];
+		switch (c) {
+			case '"':	out += "\\\""; break;
+			case '\\':	out += "\\\\"; break;
+			case '\n':	out += "\\n"; break;
+			case '\r':	out += "\\r"; break;
+			case '\t':	out += "\\t"; break;
+			default:
+				if (c < 0x20) {
+					char esc[8];
+					snprintf(esc, sizeof(esc), "\\u%04x", c);
+					out += esc;
+				} else {
+					out += (char)c;
+				}
+		}
+	}
+	out += '"';
+}
+
+//---------------------------------------------------------------------------------
+static void jsonQuote(std::string &out, const std::string &s) {
+//---------------------------------------------------------------------------------
+	jsonQuote(out, s.data(), s.size());
+}
+
+//---------------------------------------------------------------------------------
+// line based connection, stdin/stdout or a socket
+//---------------------------------------------------------------------------------
+class Connection {
+public:
+	Connection(int in, int out) : in(in), out(out), start(0), end(0) {}
+	~Connection() {
+		if (in > 2) close(in);
+		if (out > 2 && out != in) close(out);
+	}
+
+	/* false at the end of the input */
+	bool readLine(std::string &line) {
+		line.clear();
+		while (1) {
+			for (; start < end; start++) {
+				if (buffer[start] == '\n') { start++; return true; }
+				line += buffer[start];
+			}
+			ssize_t len = read(in, buffer, sizeof(buffer));
+			if (len < 0 && errno == EINTR) continue;
+			if (len <= 0) return !line.empty();
+			start = 0;
+			end = len;
+		}
+	}
+
+	/* responses of finished jobs come from the worker threads */
+	bool writeLine(const std::string &line) {
+		std::lock_guard<std::mutex> guard(lock);
+		const char *data = line.data();
+		size_t size = line.size();
+
+		while (size) {
+			ssize_t len = write(out, data, size);
+			if (len < 0 && errno == EINTR) continue;
+			if (len <= 0) return false;
+			data += len;
+			size -= len;
+		}
+		return true;
+	}
+
+private:
+	int in, out;
+	std::mutex lock;
+	char buffer[4096];
+	size_t start, end;
+};
+
+//---------------------------------------------------------------------------------
+// one request, alive until its response is written
+//---------------------------------------------------------------------------------
+struct Task {
+	std::shared_ptr<Connection> connection;
+	std::string id;				/* as sent, any JSON value */
+	std::vector<std::string> args;
+	std::vector<char *> argv;
+	std::vector<std::string> outputs;
+	gt_buffer out, err;
+	int status;
+	bool refused;				/* not run here, the client may run the tool itself */
+	double ms;
+	const char *statsTo;			/* --stats given, see gt_stats_option */
+	gt_stats stats;
+
+	Task() : id("null"), status(0), refused(false), ms(0), statsTo(NULL) {
+		memset(&out, 0, sizeof(out));
+		memset(&err, 0, sizeof(err));
+		gt_stats_init(&stats);
+	}
+	~Task() {
+		gt_buffer_free(&out);
+		gt_buffer_free(&err);
+	}
+
+	void respond() {
+		std::string line = "{\"id\":" + id + ",\"status\":" + std::to_string(status);
+		char ms_text[32];
+		snprintf(ms_text, sizeof(ms_text), ",\"ms\":%.3f", ms);
+		line += ms_text;
+		if (refused) line += ",\"refused\":true";
+
+		line += ",\"outputs\":[";
+		for (size_t i = 0; i < outputs.size(); i++) {
+			if (i) line += ',';
+			jsonQuote(line, outputs[i]);
+		}
+		line += "],\"stdout\":";
+		jsonQuote(line, (const char *)out.data, out.size);
+		line += ",\"stderr\":";
+		jsonQuote(line, (const char *)err.data, err.size);
+		if (statsTo) {
+			char text[1024];
+			int len = gt_stats_json(&stats, argv[0], text, sizeof(text));
+			if (len > 0 && len < (int)sizeof(text)) line += std::string(",\"stats\":") + text;
+		}
+		line += "}\n";
+
+		connection->writeLine(line);
+	}
+};
+
+//---------------------------------------------------------------------------------
+// worker threads
+//---------------------------------------------------------------------------------
+class Pool {
+public:
+	Pool(int threads) : done(false) {
+		if (threads <= 0) threads = std::thread::hardware_concurrency();
+		if (threads <= 0) threads = 1;
+		for (int t = 0; t < threads; t++) workers.push_back(std::thread(&Pool::work, this));
+	}
+
+	void add(const std::function<void()> &job) {
+		std::lock_guard<std::mutex> guard(lock);
+		queue.push_back(job);
+		ready.notify_one();
+	}
+
+	/* runs the queued jobs, then stops the workers */
+	void finish() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			done = true;
+			ready.notify_all();
+		}
+		for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+	}
+
+private:
+	void work() {
+		while (1) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				ready.wait(guard, [this] { return done || !queue.empty(); });
+				if (queue.empty()) return;
+				job = queue.front();
+				queue.pop_front();
+			}
+			job();
+		}
+	}
+
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<std::function<void()> > queue;
+	std::vector<std::thread> workers;
+	bool done;
+};
+
+static std::mutex parseLock;			/* tools parse with getopt and friends */
+
+//---------------------------------------------------------------------------------
+static std::string baseName(const std::string &path) {
+//---------------------------------------------------------------------------------
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+//---------------------------------------------------------------------------------
+static void handleRequest(const gt_tool *tool, Pool &pool, const std::shared_ptr<Connection> &connection, const std::string &line) {
+//---------------------------------------------------------------------------------
+	std::shared_ptr<Task> task = std::make_shared<Task>();
+	std::string toolName = tool->name, cwd, ignored;
+	gt_sink err;
+	const char *p = line.c_str();
+
+	task->connection = connection;
+	gt_buffer_sink(&err, &task->err);
+
+	bool ok = jsonObject(p, [&](const std::string &key, const char *&p) {
+		if (key == "id") {
+			const char *start = p;
+			if (!jsonValue(p)) return false;
+			task->id.assign(start, p - start);
+			return true;
+		}
+		if (key == "tool") return jsonString(p, toolName);
+		if (key == "cwd") return jsonString(p, cwd);
+		if (key == "args") {
+			return jsonArray(p, [&](const char *&p) {
+				task->args.push_back(std::string());
+				return jsonString(p, task->args.back());
+			});
+		}
+		return jsonValue(p);
+	});
+
+	if (!ok) {
+		gt_printf(&err, "%s: malformed request\n", tool->name);
+		task->status = -1;
+		task->respond();
+		return;
+	}
+
+	if (baseName(toolName) != tool->name) {
+		gt_printf(&err, "%s: this server does not run %s\n", tool->name, toolName.c_str());
+		task->status = -1;
+		task->refused = true;
+		task->respond();
+		return;
+	}
+
+	if (!cwd.empty()) {
+		char here[4096];
+		if (!getcwd(here, sizeof(here)) || cwd != here) {
+			gt_printf(&err, "%s: server runs in another directory than %s\n", tool->name, cwd.c_str());
+			task->status = -1;
+			task->refused = true;
+			task->respond();
+			return;
+		}
+	}
+
+	task->argv.push_back((char *)tool->name);
+	for (size_t i = 0; i < task->args.size(); i++) task->argv.push_back(&task->args[i][0]);
+	task->argv.push_back(NULL);
+
+	int argc = task->argv.size() - 1;
+	task->statsTo = gt_stats_option(&argc, &task->argv[0]);
+
+	void *job = NULL;
+	{
+		std::lock_guard<std::mutex> guard(parseLock);
+		task->status = tool->parse(argc, &task->argv[0], &err, &job);
+	}
+
+	if (!job) {
+		task->respond();
+		return;
+	}
+
+	if (tool->outputs) {
+		const char *names[16];
+		int count = tool->outputs(job, names, 16);
+		for (int i = 0; i < count; i++) task->outputs.push_back(names[i]);
+	}
+
+	pool.add([tool, task, job]() {
+		gt_sink out, err;
+		gt_buffer_sink(&out, &task->out);
+		gt_buffer_sink(&err, &task->err);
+
+		gt_stats *stats = task->statsTo ? &task->stats : NULL;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		task->status = tool->run(job, &out, &err, stats);
+		task->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		/* a stats file collects the runs of the server too, text goes into the response only */
+		gt_stats_phase(stats, -1);
+		if (stats && *task->statsTo && strcmp(task->statsTo, "1")) gt_stats_report(stats, tool->name, task->statsTo);
+
+		task->respond();
+	});
+}
+
+//---------------------------------------------------------------------------------
+static void serveConnection(const gt_tool *tool, Pool &pool, std::shared_ptr<Connection> connection) {
+//---------------------------------------------------------------------------------
+	std::string line;
+
+	while (connection->readLine(line)) {
+		if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+		handleRequest(tool, pool, connection, line);
+	}
+}
+
+//---------------------------------------------------------------------------------
+int gt_serve(const gt_tool *tool, const char *socketPath, int threads) {
+//---------------------------------------------------------------------------------
+	Pool pool(threads);
+
+	if (!socketPath) {
+		serveConnection(tool, pool, std::make_shared<Connection>(0, 1));
+		pool.finish();
+		return 0;
+	}
+
+#ifdef _WIN32
+	fprintf(stderr, "%s: no socket support, serving stdin\n", tool->name);
+	serveConnection(tool, pool, std::make_shared<Connection>(0, 1));
+	pool.finish();
+	return 0;
+#else
+	struct sockaddr_un address;
+	if (strlen(socketPath) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "%s: socket path too long: %s\n", tool->name, socketPath);
+		return 1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	/* clients that go away must not take the server with them */
+	signal(SIGPIPE, SIG_IGN);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socketPath);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 64) < 0) {
+		fprintf(stderr, "%s: could not listen on %s: %s\n", tool->name, socketPath, strerror(errno));
+		if (listener >= 0) close(listener);
+		return 1;
+	}
+
+	while (1) {
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			fprintf(stderr, "%s: %s\n", tool->name, strerror(errno));
+			break;
+		}
+		std::thread(serveConnection, tool, std::ref(pool), std::make_shared<Connection>(fd, fd)).detach();
+	}
+
+	close(listener);
+	unlink(socketPath);
+	return 1;
+#endif
+}
+
+//---------------------------------------------------------------------------------
+int gt_request(const char *socketPath, int argc, char **argv, const gt_sink *out, const gt_sink *log, int *status) {
+//---------------------------------------------------------------------------------
+#ifdef _WIN32
+	return -1;
+#else
+	struct sockaddr_un address;
+	if (!socketPath || strlen(socketPath) >= sizeof(address.sun_path)) return -1;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		close(fd);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	Connection connection(fd, fd);
+
+	/* argv[0] names the tool, a path to it is fine */
+	std::string tool = baseName(argv[0]);
+	std::string request = "{\"id\":1,\"tool\":";
+	jsonQuote(request, tool);
+	request += ",\"args\":[";
+	for (int i = 1; i < argc; i++) {
+		if (i > 1) request += ',';
+		jsonQuote(request, argv[i], strlen(argv[i]));
+	}
+	request += ']';
+
+	char here[4096];
+	if (getcwd(here, sizeof(here))) {
+		request += ",\"cwd\":";
+		jsonQuote(request, here, strlen(here));
+	}
+	request += "}\n";
+
+	std::string response, outText, logText;
+	if (!connection.writeLine(request) || !connection.readLine(response)) return -1;
+
+	/* output is passed on once the response is known not to be a refusal */
+	const char *p = response.c_str();
+	bool answered = false, refused = false;
+	bool ok = jsonObject(p, [&](const std::string &key, const char *&p) {
+		if (key == "status") {
+			char *end;
+			*status = strtol(p, &end, 10);
+			if (end == p) return false;
+			p = end;
+			answered = true;
+			return true;
+		}
+		if (key == "refused") {
+			refused = !strncmp(p, "true", 4);
+			return jsonValue(p);
+		}
+		if (key == "stdout") return jsonString(p, outText);
+		if (key == "stderr") return jsonString(p, logText);
+		return jsonValue(p);
+	});
+
+	if (!ok || !answered) return -1;
+	if (refused) return 1;
+	if (out && !outText.empty()) out->write(out->context, outText.data(), outText.size());
+	if (log && !logText.empty()) log->write(log->context, logText.data(), logText.size());
+	return 0;
+#endif
+}